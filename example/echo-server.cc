@@ -20,6 +20,7 @@
 
 #include "wte/connection_listener.h"
 #include "wte/event_base.h"
+#include "wte/event_base_pool.h"
 #include "wte/stream.h"
 
 #include <stdio.h>
@@ -84,9 +85,13 @@ void EchoReadCallback::error(std::runtime_error const& e) {
     delete conn_;
 }
 
-static void acceptCb(std::shared_ptr<wte::EventBase> base, int fd) {
-    Connection *conn = new Connection(base, fd);
-    conn->stream->startRead(&conn->read_cb);
+static void acceptCb(std::shared_ptr<wte::EventBasePool> pool, int fd) {
+    // Serve each connection on one of the pool's loops
+    auto base = pool->next();
+    base->runOnEventLoop([base, fd]() {
+            Connection *conn = new Connection(base, fd);
+            conn->stream->startRead(&conn->read_cb);
+        }, /*defer=*/ false);
 }
 
 static void errorCb(std::exception const& e) {
@@ -102,8 +107,9 @@ int main(int argc, char **argv) {
 #endif
 
     auto base = wte::mkEventBase();
+    auto pool = wte::mkEventBasePool();
     auto listener = wte::mkConnectionListener(base,
-        std::bind(acceptCb, base, std::placeholders::_1), errorCb);
+        std::bind(acceptCb, pool, std::placeholders::_1), errorCb);
 
     listener->bind(0);
     listener->listen(128);
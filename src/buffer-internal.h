@@ -23,9 +23,13 @@
 #ifndef SRC_BUFFER_INTERNAL_H_
 #define SRC_BUFFER_INTERNAL_H_
 
+#include <atomic>
+#include <new>
 #include <vector>
 
+#include "slab.h"
 #include "wte/buffer.h"
+#include "wte/task.h"
 
 namespace wte {
 
@@ -37,6 +41,9 @@ public:
     void append(const char *buf, size_t size) override;
     void append(std::string const& buf) override;
     void append(Buffer *o) override;
+    void appendExternal(const char *buf, size_t size, Task && release)
+        override;
+    void appendFile(int fd, off_t offset, size_t size) override;
     void prepend(const char *buf, size_t size) override;
     void prepend(std::string const& buf) override;
     void prepend(Buffer *o) override;
@@ -57,23 +64,160 @@ public:
     size_t size() const override { return size_; }
     void reserve(size_t capacity) override;
     void reserve(size_t capacity, std::vector<Extent> *extents) override;
+    void commit(size_t size) override;
+    void splitFront(size_t size, Buffer *out) override;
+    const char* pullup(size_t size) override;
+    BufferCursor cursor() const override;
+    bool find(char c, size_t offset, size_t *pos) const override;
+    bool find(const char *needle, size_t size, size_t offset, size_t *pos)
+        const override;
+    uint32_t crc32c(size_t offset, size_t size) const override;
+
+    /**
+     * Discard all data, keeping at most one extent of up to `maxRetained`
+     * bytes for subsequent appends.
+     */
+    void clear(size_t maxRetained);
+
+    std::unique_ptr<Buffer, Deleter> cloneRange(size_t offset, size_t size)
+        const override;
+
+    /** Append a range of this buffer's data to `out`, sharing storage. */
+    void shareRange(size_t offset, size_t size, BufferImpl *out) const;
+
+    // Smallest extent allocated, so that small appends coalesce
+    static const size_t kMinExtentSize = 256;
+
+    /**
+     * Reference-counted storage for extents.
+     *
+     * Cloned buffers share blocks. Bytes past the write offset of the
+     * extent that allocated a block are never visible to other extents,
+     * so appends are always safe; rewriting any other bytes requires
+     * exclusive ownership.
+     *
+     * External blocks wrap caller-owned memory, which is never written;
+     * their release task is stored after the header.
+     */
+    class Block {
+    public:
+        /** @return a block holding at least `size` bytes. */
+        static Block* create(size_t size) {
+            size_t bytes = Slab::roundUp(sizeof(Block) + size);
+            Block *block = new (Slab::allocate(bytes)) Block(
+                bytes - sizeof(Block), /*external=*/ false);
+            block->data_ = reinterpret_cast<char*>(block + 1);
+            return block;
+        }
+
+        /** @return a block wrapping `size` bytes of external memory. */
+        static Block* wrap(const char *data, size_t size, Task && release) {
+            static_assert(sizeof(Block) % alignof(Task) == 0,
+                "Misaligned release task");
+            Block *block = new (Slab::allocate(sizeof(Block) + sizeof(Task)))
+                Block(size, /*external=*/ true);
+            block->data_ = const_cast<char*>(data);
+            new (block + 1) Task(std::move(release));
+            return block;
+        }
+
+        char* data() { return data_; }
+
+        size_t capacity() const { return capacity_; }
+
+        Block* ref() {
+            refs_.fetch_add(1, std::memory_order_relaxed);
+            return this;
+        }
+
+        void unref() {
+            if (refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            if (!external_) {
+                size_t bytes = sizeof(Block) + capacity_;
+                this->~Block();
+                Slab::deallocate(this, bytes);
+                return;
+            }
+            Task *stored = reinterpret_cast<Task*>(this + 1);
+            Task release(std::move(*stored));
+            stored->~Task();
+            this->~Block();
+            Slab::deallocate(this, sizeof(Block) + sizeof(Task));
+            if (release) {
+                release();
+            }
+        }
+
+        bool shared() const {
+            return refs_.load(std::memory_order_acquire) > 1;
+        }
+
+        bool external() const { return external_; }
+    private:
+        Block(size_t capacity, bool external)
+            : refs_(1), capacity_(capacity), data_(nullptr),
+              external_(external) { }
+        std::atomic<size_t> refs_;
+        const size_t capacity_;
+        char *data_;
+        const bool external_;
+    };
 
     struct InternalExtent {
         Extent extent;
         size_t read_offset;
         size_t write_offset;
+        Block *block;
 
         struct InternalExtent *prev;
         struct InternalExtent *next;
 
-        explicit InternalExtent(size_t size) : extent({size, new char[size]}),
-            read_offset(0), write_offset(0), prev(nullptr), next(nullptr) { }
+        // Space for at least `size` bytes
+        explicit InternalExtent(size_t size) : read_offset(0),
+                write_offset(0), block(Block::create(
+                    size < kMinExtentSize ? kMinExtentSize : size)),
+                prev(nullptr),
+                next(nullptr) {
+            extent = Extent {block->capacity(), block->data()};
+        }
+
+        // A read-only view of `size` readable bytes of `o` from `offset`
+        InternalExtent(InternalExtent const& o, size_t offset, size_t size)
+            : extent({size, o.extent.data + o.read_offset + offset}),
+              read_offset(0), write_offset(size), block(o.block->ref()),
+              prev(nullptr), next(nullptr) { }
+
+        // The whole of an external block, which is never written
+        explicit InternalExtent(Block *b)
+            : extent({b->capacity(), b->data()}), read_offset(0),
+              write_offset(b->capacity()), block(b), prev(nullptr),
+              next(nullptr) { }
 
         InternalExtent() : extent({0, nullptr}), read_offset(0),
-            write_offset(0), prev(nullptr), next(nullptr) { }
+            write_offset(0), block(nullptr), prev(nullptr), next(nullptr) { }
 
         ~InternalExtent() {
-            delete [] extent.data;
+            if (block) {
+                block->unref();
+            }
+        }
+
+        InternalExtent(InternalExtent const&) = delete;
+        InternalExtent& operator=(InternalExtent const&) = delete;
+
+        static void* operator new(size_t size) {
+            return Slab::allocate(size);
+        }
+
+        static void operator delete(void *ptr, size_t size) {
+            Slab::deallocate(ptr, size);
+        }
+
+        // Whether bytes before the write offset may be rewritten
+        bool exclusive() const {
+            return block && !block->shared() && !block->external();
         }
 
         size_t appendable() const {
@@ -81,15 +225,13 @@ public:
         }
 
         size_t prependable() const {
-            return read_offset;
+            return exclusive() ? read_offset : 0;
         }
 
         size_t readable() const {
-            return extent.size - read_offset;
+            return write_offset - read_offset;
         }
 
-        bool empty() const { return appendable() == 0; }
-
         size_t append(const char *buf, size_t size);
         size_t prepend(const char *buf, size_t size);
         size_t copyout(char *buf, size_t size);
@@ -99,15 +241,22 @@ private:
     bool list_empty() const;
     void read(char *buf, size_t size, size_t *nread, bool consume);
 
+    // Unlink and free an extent with no readable data. The tail is instead
+    // kept for subsequent appends, emptied if its storage is exclusive.
+    void release(InternalExtent *cur);
+
     // Does not free memory; take care
     void reset() {
         head_.prev = &head_;
         head_.next = &head_;
         size_ = 0;
+        reserved_ = nullptr;
     }
 
     InternalExtent head_;
     size_t size_;
+    // First extent returned by the last `reserve`, pending `commit`
+    InternalExtent *reserved_;
 };
 
 } // wte namespace
@@ -21,81 +21,98 @@
  */
 
 #include <string.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include <algorithm>
-#include <limits>
+#include <stdexcept>
 #include <utility>
 
 #include "buffer-internal.h"
+#include "buffer_kernels.h"
 #include "wte/buffer.h"
+#include "xplat-io.h"
 
 namespace wte {
 
 size_t BufferImpl::InternalExtent::append(const char *buf, size_t size) {
-    char *data = extent.data;
-    size_t space = write_offset - extent.size;
-    if (space == 0) {
-        return 0;
-    }
-    size_t nwrite = std::min(space, size);
-    memcpy(data + write_offset, buf, nwrite);
+    size_t nwrite = std::min(appendable(), size);
+    memcpy(extent.data + write_offset, buf, nwrite);
     write_offset += nwrite;
-
-    // assert write_offset <= extent.size
-
     return nwrite;
 }
 
 size_t BufferImpl::InternalExtent::prepend(const char *buf, size_t size) {
-    char *data = extent.data;
-    size_t space = read_offset;
-    if (space == 0) {
-        return 0;
-    }
-    size_t nwrite = std::min(space, size);
-    memcpy(data, buf, nwrite);
-
-    // assert read_offset <= nwrite
-
+    // Fill backwards from the read offset with the tail of `buf`, so that
+    // any remainder is a prefix of `buf`
+    size_t nwrite = std::min(prependable(), size);
     read_offset -= nwrite;
+    memcpy(extent.data + read_offset, buf + size - nwrite, nwrite);
     return nwrite;
 }
 
 size_t BufferImpl::InternalExtent::copyout(char *buf, size_t size) {
-    size_t ret = std::min(size, extent.size - read_offset);
+    size_t ret = std::min(size, readable());
     memcpy(buf, extent.data + read_offset, ret);
     return ret;
 }
 
 size_t BufferImpl::InternalExtent::consume(size_t size) {
-    // assert read_offset + size <= extent.size
+    // assert size <= readable()
     read_offset += size;
-    return extent.size - read_offset;
+    return readable();
 }
 
-BufferImpl::BufferImpl() : size_(0) {
+BufferImpl::BufferImpl() : size_(0), reserved_(nullptr) {
     head_.prev = &head_;
     head_.next = &head_;
 }
 
 BufferImpl::~BufferImpl() {
-    drain(std::numeric_limits<size_t>::max());
+    InternalExtent *cur = head_.next;
+    while (cur != &head_) {
+        InternalExtent *next = cur->next;
+        delete cur;
+        cur = next;
+    }
+}
+
+namespace {
+
+// Smaller pieces of a split extent are copied rather than shared
+const size_t kMinSharedSplit = 512;
+
+} // unnamed namespace
+
+void BufferImpl::release(InternalExtent *cur) {
+    if (cur == head_.prev) {
+        if (cur->exclusive()) {
+            // Keep the (now empty) space for subsequent appends
+            cur->read_offset = cur->write_offset = 0;
+            return;
+        } else if (cur->appendable() > 0) {
+            return;
+        }
+    }
+    cur->prev->next = cur->next;
+    cur->next->prev = cur->prev;
+    delete cur;
 }
 
 void BufferImpl::drain(size_t count) {
-    size_t remain = count;
-    while (remain > 0 && !list_empty()) {
-        auto cur = head_.next;
+    size_t remain = std::min(count, size_);
+    size_ -= remain;
+    while (remain > 0) {
+        // Extents hold at least `remain` readable bytes
+        InternalExtent *cur = head_.next;
         size_t consume = std::min(remain, cur->readable());
-        size_t node_remain = cur->consume(consume);
-        if (node_remain == 0) {
-            cur->prev->next = cur->next;
-            cur->next->prev = cur->prev;
-            delete cur;
+        if (cur->consume(consume) == 0) {
+            release(cur);
         }
         remain -= consume;
     }
-    size_ -= (count - remain);
 }
 
 bool BufferImpl::empty() const {
@@ -128,6 +145,58 @@ inline void listPrepend(BufferImpl::InternalExtent *head,
     listPrepend(head, node, node);
 }
 
+void BufferImpl::clear(size_t maxRetained) {
+    InternalExtent *keep = nullptr;
+    InternalExtent *cur = head_.next;
+    while (cur != &head_) {
+        InternalExtent *next = cur->next;
+        if (!keep && cur->exclusive() && cur->extent.size <= maxRetained) {
+            keep = cur;
+        } else {
+            delete cur;
+        }
+        cur = next;
+    }
+
+    reset();
+    if (keep) {
+        keep->read_offset = keep->write_offset = 0;
+        listAppend(&head_, keep);
+    }
+}
+
+void BufferImpl::splitFront(size_t size, Buffer *out) {
+    BufferImpl *dst = static_cast<BufferImpl*>(out);
+    size_t remain = std::min(size, size_);
+    while (remain > 0) {
+        InternalExtent *cur = head_.next;
+        size_t avail = cur->readable();
+        if (avail <= remain && cur != head_.prev) {
+            cur->prev->next = cur->next;
+            cur->next->prev = cur->prev;
+            listAppend(&dst->head_, cur);
+            dst->size_ += avail;
+            size_ -= avail;
+            remain -= avail;
+            continue;
+        }
+
+        // Share the boundary extent, unless it is cheaper to copy
+        size_t count = std::min(avail, remain);
+        if (count < kMinSharedSplit) {
+            dst->append(cur->extent.data + cur->read_offset, count);
+        } else {
+            listAppend(&dst->head_, new InternalExtent(*cur, 0, count));
+            dst->size_ += count;
+        }
+        size_ -= count;
+        remain -= count;
+        if (cur->consume(count) == 0) {
+            release(cur);
+        }
+    }
+}
+
 bool BufferImpl::list_empty() const {
     return head_.prev == &head_; // also head_.next == &head_
 }
@@ -139,13 +208,15 @@ void BufferImpl::append(const char *buf, size_t size) {
     }
 
     size_t remain = size;
-    do {
+    while (remain > 0) {
         if (!cur || cur->appendable() == 0) {
             cur = new InternalExtent(remain);
             listAppend(&head_, cur);
         }
-        remain -= cur->append(buf, remain);
-    } while (remain > size);
+        size_t nwrite = cur->append(buf, remain);
+        buf += nwrite;
+        remain -= nwrite;
+    }
 
     size_ += size;
 }
@@ -166,6 +237,44 @@ void BufferImpl::append(Buffer *orig) {
     o->reset();
 }
 
+void BufferImpl::appendExternal(const char *buf, size_t size,
+        Task && release) {
+    if (size == 0) {
+        if (release) {
+            release();
+        }
+        return;
+    }
+    listAppend(&head_, new InternalExtent(
+        Block::wrap(buf, size, std::move(release))));
+    size_ += size;
+}
+
+void BufferImpl::appendFile(int fd, off_t offset, size_t size) {
+#if !defined(_WIN32)
+    if (size == 0) {
+        return;
+    }
+    // Pages past the end of the file fault when accessed
+    if (!xfileHasRange(fd, offset, size)) {
+        throw std::runtime_error("Region extends beyond the end of the file");
+    }
+    // Mappings start on a page boundary
+    static const off_t kPageSize = sysconf(_SC_PAGESIZE);
+    size_t lead = offset % kPageSize;
+    size_t length = lead + size;
+    void *addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd,
+        offset - lead);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file");
+    }
+    appendExternal(static_cast<const char*>(addr) + lead, size,
+        [addr, length]() { munmap(addr, length); });
+#else
+    throw std::runtime_error("File extents are not supported");
+#endif
+}
+
 void BufferImpl::prepend(const char *buf, size_t size) {
     InternalExtent *cur = nullptr;
     if (!list_empty()) {
@@ -173,7 +282,7 @@ void BufferImpl::prepend(const char *buf, size_t size) {
     }
 
     size_t remain = size;
-    do {
+    while (remain > 0) {
         if (!cur || cur->prependable() == 0) {
             cur = new InternalExtent(remain);
             remain -= cur->append(buf, remain);
@@ -184,7 +293,7 @@ void BufferImpl::prepend(const char *buf, size_t size) {
         } else {
             remain -= cur->prepend(buf, remain);
         }
-    } while (remain > 0);
+    }
 
     size_ += size;
 }
@@ -206,18 +315,17 @@ void BufferImpl::prepend(Buffer *orig) {
 }
 
 void BufferImpl::reserve(size_t size) {
-    size_t required = size;
-    if (!list_empty()) {
-        required -= head_.prev->appendable();
-    }
-    if (required > 0) {
-        InternalExtent *cur = new InternalExtent(required);
+    size_t avail = list_empty() ? 0 : head_.prev->appendable();
+    if (avail < size) {
+        InternalExtent *cur = new InternalExtent(size - avail);
         listAppend(&head_, cur);
     }
 }
 
 void BufferImpl::reserve(size_t size, std::vector<Extent> *extents) {
     extents->reserve(2);
+    reserved_ = nullptr;
+
     size_t required = size;
     if (!list_empty()) {
         InternalExtent *p = head_.prev;
@@ -225,14 +333,34 @@ void BufferImpl::reserve(size_t size, std::vector<Extent> *extents) {
         if (avail > 0) {
             extents->emplace_back(Extent{avail,
                 p->extent.data + p->write_offset});
-            required -= avail;
+            reserved_ = p;
+            required -= std::min(avail, required);
         }
     }
     if (required > 0) {
         InternalExtent *cur = new InternalExtent(required);
         listAppend(&head_, cur);
-        extents->emplace_back(Extent{required, cur->extent.data});
+        extents->emplace_back(Extent{cur->appendable(), cur->extent.data});
+        if (!reserved_) {
+            reserved_ = cur;
+        }
+    }
+}
+
+void BufferImpl::commit(size_t size) {
+    InternalExtent *cur = reserved_ ? reserved_ : head_.prev;
+    size_t remain = size;
+    while (remain > 0 && cur != &head_) {
+        size_t nwrite = std::min(remain, cur->appendable());
+        cur->write_offset += nwrite;
+        remain -= nwrite;
+        cur = cur->next;
     }
+
+    // assert remain == 0
+
+    size_ += size - remain;
+    reserved_ = nullptr;
 }
 
 void BufferImpl::read(char *buf, size_t size, size_t *nread) {
@@ -243,29 +371,18 @@ void BufferImpl::read(char *buf, size_t size, size_t *nread, bool consume) {
     InternalExtent *cur = head_.next;
     size_t total = 0;
     while (cur != &head_ && total < size) {
-        size_t tmpread = cur->copyout(buf, size);
+        InternalExtent *next = cur->next;
+        size_t tmpread = cur->copyout(buf + total, size - total);
         total += tmpread;
-        buf += tmpread;
-        if (!consume) {
-            cur = cur->next;
-            continue;
-        }
-
-        size_ -= tmpread;
-
-        size_t remain = cur->consume(tmpread);
-        if (remain == 0) {
-            cur->prev->next = cur->next;
-            cur->next->prev = cur->prev;
-            auto next = cur->next;
-            delete cur;
-            cur = next;
-        } else {
-            // assert total == size
-            break;
+        if (consume && cur->consume(tmpread) == 0) {
+            release(cur);
         }
+        cur = next;
     }
 
+    if (consume) {
+        size_ -= total;
+    }
     *nread = total;
 }
 
@@ -284,12 +401,249 @@ void BufferImpl::peek(size_t size, std::vector<Extent> *extents) const {
             size_t grant = std::min(avail, size - total);
             extents->push_back(
                 Extent {grant, cur->extent.data + cur->read_offset});
+            total += grant;
         }
-        total += avail;
         cur = cur->next;
     }
 }
 
+std::unique_ptr<Buffer, Buffer::Deleter> BufferImpl::cloneRange(
+        size_t offset, size_t size) const {
+    BufferImpl *clone = new BufferImpl();
+    shareRange(offset, size, clone);
+    return std::unique_ptr<Buffer, Deleter>(clone);
+}
+
+void BufferImpl::shareRange(size_t offset, size_t size, BufferImpl *out)
+        const {
+    size_t skip = std::min(offset, size_);
+    size_t remain = std::min(size, size_ - skip);
+    for (InternalExtent *cur = head_.next; cur != &head_ && remain > 0;
+            cur = cur->next) {
+        size_t avail = cur->readable();
+        if (skip >= avail) {
+            skip -= avail;
+            continue;
+        }
+        size_t count = std::min(avail - skip, remain);
+        listAppend(&out->head_, new InternalExtent(*cur, skip, count));
+        out->size_ += count;
+        remain -= count;
+        skip = 0;
+    }
+}
+
+const char* BufferImpl::pullup(size_t size) {
+    if (size > size_) {
+        return nullptr;
+    }
+    InternalExtent *first = head_.next;
+    if (first == &head_) {
+        return nullptr;
+    }
+    if (first->readable() >= size) {
+        return first->extent.data + first->read_offset;
+    }
+
+    if (first->appendable() < size - first->readable()
+            && first->exclusive() && first->extent.size >= size) {
+        // Compact to make room at the end
+        memmove(first->extent.data, first->extent.data + first->read_offset,
+            first->readable());
+        first->write_offset = first->readable();
+        first->read_offset = 0;
+    }
+    if (first->appendable() < size - first->readable()) {
+        InternalExtent *dst = new InternalExtent(size);
+        listPrepend(&head_, dst);
+        first = dst;
+    }
+
+    // Move just enough of the following extents into the first
+    while (first->readable() < size) {
+        InternalExtent *cur = first->next;
+        size_t count = first->append(cur->extent.data + cur->read_offset,
+            std::min(size - first->readable(), cur->readable()));
+        if (cur->consume(count) == 0) {
+            release(cur);
+        }
+    }
+    return first->extent.data + first->read_offset;
+}
+
+BufferCursor BufferImpl::cursor() const {
+    return BufferCursor(&head_, head_.next);
+}
+
+bool BufferImpl::find(char c, size_t offset, size_t *pos) const {
+    BufferCursor cur = cursor();
+    cur.advance(offset);
+    if (!cur.find(c)) {
+        return false;
+    }
+    *pos = cur.position();
+    return true;
+}
+
+bool BufferImpl::find(const char *needle, size_t size, size_t offset,
+        size_t *pos) const {
+    if (offset > size_) {
+        return false;
+    }
+    BufferCursor cur = cursor();
+    cur.advance(offset);
+    if (!cur.find(needle, size)) {
+        return false;
+    }
+    *pos = cur.position();
+    return true;
+}
+
+uint32_t BufferImpl::crc32c(size_t offset, size_t size) const {
+    uint32_t crc = 0;
+    for (InternalExtent *cur = head_.next; cur != &head_ && size > 0;
+            cur = cur->next) {
+        size_t avail = cur->readable();
+        if (offset >= avail) {
+            offset -= avail;
+            continue;
+        }
+        size_t count = std::min(size, avail - offset);
+        crc = BufferKernels::crc32c(crc,
+            cur->extent.data + cur->read_offset + offset, count);
+        size -= count;
+        offset = 0;
+    }
+    return crc;
+}
+
+namespace {
+
+typedef BufferImpl::InternalExtent InternalExtent;
+
+inline const InternalExtent* asExtent(const void *p) {
+    return static_cast<const InternalExtent*>(p);
+}
+
+inline const char* readPtr(const InternalExtent *e) {
+    return e->extent.data + e->read_offset;
+}
+
+} // unnamed namespace
+
+BufferCursor::BufferCursor(const void *head, const void *extent)
+        : head_(head), extent_(extent), offset_(0), position_(0) {
+    normalize();
+}
+
+void BufferCursor::normalize() {
+    while (extent_ != head_ && offset_ == asExtent(extent_)->readable()) {
+        extent_ = asExtent(extent_)->next;
+        offset_ = 0;
+    }
+}
+
+char BufferCursor::operator*() const {
+    return readPtr(asExtent(extent_))[offset_];
+}
+
+size_t BufferCursor::advance(size_t size) {
+    size_t remain = size;
+    while (remain > 0 && extent_ != head_) {
+        size_t count = std::min(remain,
+            asExtent(extent_)->readable() - offset_);
+        offset_ += count;
+        position_ += count;
+        remain -= count;
+        normalize();
+    }
+    return size - remain;
+}
+
+bool BufferCursor::find(char c) {
+    while (extent_ != head_) {
+        const InternalExtent *cur = asExtent(extent_);
+        const char *start = readPtr(cur) + offset_;
+        size_t avail = cur->readable() - offset_;
+        const char *match = BufferKernels::findByte(start, avail, c);
+        if (match) {
+            size_t skip = match - start;
+            offset_ += skip;
+            position_ += skip;
+            return true;
+        }
+        offset_ += avail;
+        position_ += avail;
+        normalize();
+    }
+    return false;
+}
+
+bool BufferCursor::find(const char *pattern, size_t size) {
+    if (size == 0) {
+        return true;
+    }
+    while (extent_ != head_) {
+        const InternalExtent *cur = asExtent(extent_);
+        const char *start = readPtr(cur) + offset_;
+        size_t avail = cur->readable() - offset_;
+
+        // Matches within the extent precede any that span the next one
+        const char *match = BufferKernels::findPattern(start, avail,
+            pattern, size);
+        if (match) {
+            advance(match - start);
+            return true;
+        }
+
+        // Check the candidates that span into the following extents
+        size_t spanning = std::min(avail, size - 1);
+        advance(avail - spanning);
+        for (; spanning > 0; --spanning) {
+            if (**this == pattern[0] && compare(pattern, size)) {
+                return true;
+            }
+            advance(1);
+        }
+    }
+    return false;
+}
+
+bool BufferCursor::compare(const char *data, size_t size) const {
+    const void *extent = extent_;
+    size_t offset = offset_;
+    while (size > 0) {
+        if (extent == head_) {
+            return false;
+        }
+        const InternalExtent *cur = asExtent(extent);
+        size_t count = std::min(size, cur->readable() - offset);
+        if (0 != memcmp(readPtr(cur) + offset, data, count)) {
+            return false;
+        }
+        data += count;
+        size -= count;
+        extent = cur->next;
+        offset = 0;
+    }
+    return true;
+}
+
+size_t BufferCursor::copyTo(char *out, size_t size) const {
+    const void *extent = extent_;
+    size_t offset = offset_;
+    size_t total = 0;
+    while (total < size && extent != head_) {
+        const InternalExtent *cur = asExtent(extent);
+        size_t count = std::min(size - total, cur->readable() - offset);
+        memcpy(out + total, readPtr(cur) + offset, count);
+        total += count;
+        extent = cur->next;
+        offset = 0;
+    }
+    return total;
+}
+
 Buffer::~Buffer() { }
 
 Buffer* Buffer::mkBuffer() {
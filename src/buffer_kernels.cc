@@ -0,0 +1,214 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "buffer_kernels.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define WTE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace wte {
+
+namespace {
+
+// Reflected Castagnoli polynomial
+const uint32_t kCrc32cPoly = 0x82f63b78;
+
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPoly : 0);
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+Crc32cTable const& crc32cTable() {
+    static const Crc32cTable instance;
+    return instance;
+}
+
+#if defined(WTE_X86_KERNELS)
+
+__attribute__((target("avx2")))
+const char* findByteAvx2(const char *data, size_t size, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(data + i));
+        uint32_t mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(block, needle));
+        if (mask) {
+            return data + i + __builtin_ctz(mask);
+        }
+    }
+    return BufferKernels::Scalar::findByte(data + i, size - i, c);
+}
+
+// Compares the first and last pattern bytes at 32 candidate positions at a
+// time, verifying only the candidates that match both.
+__attribute__((target("avx2")))
+const char* findPatternAvx2(const char *data, size_t size,
+        const char *pattern, size_t patternSize) {
+    if (patternSize == 1) {
+        return findByteAvx2(data, size, pattern[0]);
+    }
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[patternSize - 1]);
+    size_t i = 0;
+    for (; i + patternSize - 1 + 32 <= size; i += 32) {
+        __m256i head = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(data + i));
+        __m256i tail = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(data + i + patternSize - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+        while (mask) {
+            const char *candidate = data + i + __builtin_ctz(mask);
+            if (0 == memcmp(candidate + 1, pattern + 1, patternSize - 2)) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return BufferKernels::Scalar::findPattern(data + i, size - i, pattern,
+        patternSize);
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(uint32_t crc, const char *data, size_t size) {
+    crc = ~crc;
+    while (size > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --size;
+    }
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    for (; size >= 4; size -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return ~crc;
+}
+
+#endif // WTE_X86_KERNELS
+
+struct Kernels {
+    const char* (*findByte)(const char*, size_t, char);
+    const char* (*findPattern)(const char*, size_t, const char*, size_t);
+    uint32_t (*crc32c)(uint32_t, const char*, size_t);
+
+    Kernels()
+        : findByte(&BufferKernels::Scalar::findByte),
+          findPattern(&BufferKernels::Scalar::findPattern),
+          crc32c(&BufferKernels::Scalar::crc32c) {
+#if defined(WTE_X86_KERNELS)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            findByte = &findByteAvx2;
+            findPattern = &findPatternAvx2;
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            crc32c = &crc32cSse42;
+        }
+#endif
+    }
+};
+
+// Initialized on first use, which may precede static initialization
+Kernels const& kernels() {
+    static const Kernels instance;
+    return instance;
+}
+
+} // unnamed namespace
+
+const char* BufferKernels::findByte(const char *data, size_t size, char c) {
+    return kernels().findByte(data, size, c);
+}
+
+const char* BufferKernels::findPattern(const char *data, size_t size,
+        const char *pattern, size_t patternSize) {
+    if (patternSize > size) {
+        return nullptr;
+    }
+    return kernels().findPattern(data, size, pattern, patternSize);
+}
+
+uint32_t BufferKernels::crc32c(uint32_t crc, const char *data, size_t size) {
+    return kernels().crc32c(crc, data, size);
+}
+
+const char* BufferKernels::Scalar::findByte(const char *data, size_t size,
+        char c) {
+    return static_cast<const char*>(memchr(data, c, size));
+}
+
+const char* BufferKernels::Scalar::findPattern(const char *data, size_t size,
+        const char *pattern, size_t patternSize) {
+    if (patternSize > size) {
+        return nullptr;
+    }
+    const char *end = data + size - patternSize + 1;
+    while (data < end) {
+        data = findByte(data, end - data, pattern[0]);
+        if (!data) {
+            return nullptr;
+        }
+        if (0 == memcmp(data + 1, pattern + 1, patternSize - 1)) {
+            return data;
+        }
+        ++data;
+    }
+    return nullptr;
+}
+
+uint32_t BufferKernels::Scalar::crc32c(uint32_t crc, const char *data,
+        size_t size) {
+    const uint32_t *table = crc32cTable().entries;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff]
+            ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+} // wte namespace
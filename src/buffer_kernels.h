@@ -0,0 +1,67 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_BUFFER_KERNELS_H_
+#define SRC_BUFFER_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wte {
+
+/**
+ * Search and checksum primitives over contiguous data.
+ *
+ * The implementation is chosen once per process: AVX2 searches and SSE4.2
+ * CRC32C instructions where the CPU supports them, and portable scalar
+ * code otherwise. The `scalar` variants are always available.
+ */
+class BufferKernels {
+public:
+    /** @return the first occurrence of `c` in `data`, or nullptr. */
+    static const char* findByte(const char *data, size_t size, char c);
+
+    /**
+     * @return the first occurrence of the non-empty `pattern` in `data`,
+     *         or nullptr
+     */
+    static const char* findPattern(const char *data, size_t size,
+        const char *pattern, size_t patternSize);
+
+    /**
+     * Extend a CRC32C (Castagnoli) checksum.
+     *
+     * @param crc the checksum of the preceding data, or 0 to start
+     * @return the checksum including `data`
+     */
+    static uint32_t crc32c(uint32_t crc, const char *data, size_t size);
+
+    /** Portable implementations, exposed for testing. */
+    struct Scalar {
+        static const char* findByte(const char *data, size_t size, char c);
+        static const char* findPattern(const char *data, size_t size,
+            const char *pattern, size_t patternSize);
+        static uint32_t crc32c(uint32_t crc, const char *data, size_t size);
+    };
+};
+
+} // wte namespace
+
+#endif // SRC_BUFFER_KERNELS_H_
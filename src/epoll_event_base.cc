@@ -0,0 +1,287 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "epoll_event_base.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <stdexcept>
+
+#include "wte/event_handler.h"
+
+namespace wte {
+
+namespace {
+
+// Initial number of events harvested per epoll_wait; grows on demand
+const size_t kInitialEvents = 64;
+
+uint32_t toEpoll(What what) {
+    switch (what) {
+    case What::READ:
+        return EPOLLIN;
+    case What::WRITE:
+        return EPOLLOUT;
+    case What::READ_WRITE:
+        return EPOLLIN | EPOLLOUT;
+    default:
+        return 0;
+    }
+}
+
+What fromEpoll(uint32_t events, What watched) {
+    // Like libevent, report errors and hangups to whichever of read and
+    // write the handler is watching, so that it observes the failure.
+    bool read = events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+    bool write = events & (EPOLLOUT | EPOLLERR | EPOLLHUP);
+    read = read && isRead(watched);
+    write = write && isWrite(watched);
+
+    if (read && write) {
+        return What::READ_WRITE;
+    } else if (read) {
+        return What::READ;
+    } else if (write) {
+        return What::WRITE;
+    }
+    return What::NONE;
+}
+
+} // unnamed namespace
+
+EpollEventBase::EpollEventBase(EventBaseOptions const& options)
+        : NotifyingEventBase(options), epfd_(epoll_create1(EPOLL_CLOEXEC)),
+          edgeTriggered_(options.edgeTriggered), breakLoop_(false),
+          registered_(0), timers_(this, options.timerTickMillis), events_(kInitialEvents) {
+    if (-1 == epfd_) {
+        throw std::runtime_error("Failed to create epoll descriptor");
+    }
+    registerHandlerInternal(notifyHandler(), What::READ, /*internal=*/ true);
+}
+
+EpollEventBase::~EpollEventBase() {
+    notifyHandler()->unregister();
+
+    close(epfd_);
+}
+
+void EpollEventBase::loop(LoopMode mode) {
+    beginLoop();
+
+    do {
+        if (mode == LoopMode::SPIN) {
+            spin();
+            break;
+        }
+
+        // Always run ops in the notification queue
+        runOpsInQueue();
+
+        bool nonEmpty = dispatch(mode == LoopMode::FOREVER);
+
+        if (mode == LoopMode::ONCE) {
+            break;
+        }
+
+        if (mode == LoopMode::UNTIL_EMPTY && !nonEmpty) {
+            break;
+        }
+    } while (!terminating());
+
+    breakLoop_ = false;
+    endLoop();
+}
+
+bool EpollEventBase::dispatch(bool forever) {
+    if (!forever && registered_ == 0 && timers_.empty()) {
+        return false;
+    }
+
+    // Like libevent's EVLOOP_ONCE, block until something fires
+    for (;;) {
+        beginWait();
+
+        if (breakLoop_) {
+            breakLoop_ = false;
+            return true;
+        }
+
+        if (waitAndDispatch(timers_.waitMillis()) > 0) {
+            return true;
+        }
+    }
+}
+
+size_t EpollEventBase::waitAndDispatch(int timeoutMillis) {
+    int nready = epoll_wait(epfd_, events_.data(), events_.size(),
+        timeoutMillis);
+    endWait();
+    if (nready < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        throw std::runtime_error("epoll_wait failed");
+    }
+
+    for (int i = 0; i < nready; ++i) {
+        int fd = events_[i].data.fd;
+        // Earlier callbacks in this batch may have unregistered handlers
+        EventHandler *handler = static_cast<size_t>(fd) < handlers_.size() ?
+            handlers_[fd] : nullptr;
+        if (!handler) {
+            continue;
+        }
+        What what = fromEpoll(events_[i].events, handler->watched());
+        if (what != What::NONE) {
+            handler->ready(what);
+        }
+    }
+
+    size_t expired = timers_.expire();
+
+    if (static_cast<size_t>(nready) == events_.size()) {
+        events_.resize(events_.size() * 2);
+    }
+
+    return nready + expired;
+}
+
+size_t EpollEventBase::poll() {
+    return waitAndDispatch(0);
+}
+
+void EpollEventBase::wait() {
+    dispatch(/*forever=*/ true);
+}
+
+void EpollEventBase::breakLoop() {
+    breakLoop_ = true;
+}
+
+void EpollEventBase::registerHandler(EventHandler *handler, What what) {
+    assert(inLoopThread());
+    registerHandlerInternal(handler, what, /*internal event=*/ false);
+}
+
+void EpollEventBase::registerHandlerInternal(EventHandler *handler,
+        What what, bool internal_event) {
+    if (what == What::NONE) {
+        unregisterHandler(handler);
+        return;
+    }
+
+    EpollEventHandler *impl = static_cast<EpollEventHandler*>(
+        EventHandlerImpl::get(handler));
+
+    if (impl) {
+        assert(impl->base() == this);
+        if (what == impl->watched_) {
+            // No change
+            return;
+        }
+    } else {
+        impl = new EpollEventHandler(this);
+        EventHandlerImpl::set(handler, impl);
+    }
+
+    const int fd = handler->fd();
+    const bool add = !impl->registered();
+
+    if (add) {
+        if (fd < 0) {
+            throw std::runtime_error("Invalid file descriptor");
+        }
+        if (static_cast<size_t>(fd) >= handlers_.size()) {
+            handlers_.resize(fd + 1, nullptr);
+        }
+        if (handlers_[fd]) {
+            throw std::runtime_error(
+                "Descriptor already has a registered handler");
+        }
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = toEpoll(what);
+    if (edgeTriggered_ && !internal_event) {
+        ev.events |= EPOLLET;
+    }
+    ev.data.fd = fd;
+
+    if (-1 == epoll_ctl(epfd_, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev)) {
+        throw std::runtime_error("Failed to register handler");
+    }
+
+    if (add) {
+        handlers_[fd] = handler;
+        impl->internal_ = internal_event;
+        if (!internal_event) {
+            ++registered_;
+        }
+    }
+    impl->watched_ = what;
+}
+
+void EpollEventBase::unregisterHandler(EventHandler *handler) {
+    assert(inLoopThread());
+
+    if (!handler->base()) {
+        return;
+    }
+
+    assert(handler->base() == this);
+
+    EpollEventHandler *impl = static_cast<EpollEventHandler*>(
+        EventHandlerImpl::get(handler));
+
+    if (!impl->registered()) {
+        return;
+    }
+
+    const int fd = handler->fd();
+
+    // Fails harmlessly if the descriptor has already been closed
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+
+    handlers_[fd] = nullptr;
+    if (!impl->internal_) {
+        --registered_;
+    }
+    impl->watched_ = What::NONE;
+}
+
+void EpollEventBase::registerTimeout(Timeout *timeout,
+        struct timeval *duration) {
+    assert(inLoopThread());
+    timers_.add(timeout, duration);
+}
+
+void EpollEventBase::unregisterTimeout(Timeout *timeout) {
+    assert(inLoopThread());
+    timers_.remove(timeout);
+}
+
+} // wte namespace
@@ -0,0 +1,107 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_EPOLL_EVENT_BASE_H_
+#define SRC_EPOLL_EVENT_BASE_H_
+
+#include <sys/epoll.h>
+
+#include <vector>
+
+#include "event_handler_impl.h"
+#include "notifying_event_base.h"
+#include "timer_wheel.h"
+#include "wte/event_base.h"
+
+namespace wte {
+
+/**
+ * An event base driven directly by epoll(7).
+ *
+ * Handlers are kept in a dense table indexed by file descriptor, so
+ * dispatch is a single lookup per ready descriptor and a handler that is
+ * unregistered mid-dispatch is simply skipped. Interest changes are applied
+ * in place with EPOLL_CTL_MOD.
+ */
+class EpollEventBase final : public NotifyingEventBase {
+public:
+    explicit EpollEventBase(EventBaseOptions const& options);
+    ~EpollEventBase();
+
+    void loop(LoopMode mode) override;
+    void registerHandler(EventHandler*, What) override;
+    void unregisterHandler(EventHandler*) override;
+    bool edgeTriggered() const override { return edgeTriggered_; }
+    void registerTimeout(Timeout *, struct timeval *duration) override;
+    void unregisterTimeout(Timeout *) override;
+protected:
+    void breakLoop() override;
+    size_t poll() override;
+    void wait() override;
+private:
+    void registerHandlerInternal(EventHandler*, What, bool internal_event);
+
+    /**
+     * Wait for and dispatch ready handlers and expired timeouts.
+     *
+     * @param forever whether to wait even if nothing is registered
+     * @return false if no events were registered on entry
+     */
+    bool dispatch(bool forever);
+
+    /**
+     * Wait up to `timeoutMillis` and dispatch ready handlers and expired
+     * timeouts.
+     *
+     * @return the number of descriptors and timeouts dispatched
+     */
+    size_t waitAndDispatch(int timeoutMillis);
+
+    int epfd_;
+    bool edgeTriggered_;
+    bool breakLoop_;
+    // Registered handlers, indexed by file descriptor
+    std::vector<EventHandler*> handlers_;
+    // Number of registered non-internal handlers
+    size_t registered_;
+    TimerWheel timers_;
+    std::vector<struct epoll_event> events_;
+};
+
+class EpollEventHandler final : public EventHandlerImpl {
+public:
+    explicit EpollEventHandler(EventBase *base)
+        : base_(base), watched_(What::NONE), internal_(false) { }
+    What watched() override { return watched_; }
+    EventBase* base() override { return base_; }
+    bool registered() override { return watched_ != What::NONE; }
+private:
+    EventBase *base_;
+    What watched_;
+    bool internal_;
+
+    friend class EpollEventBase;
+};
+
+} // wte namespace
+
+#endif // SRC_EPOLL_EVENT_BASE_H_
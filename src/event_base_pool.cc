@@ -0,0 +1,221 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "wte/event_base_pool.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace wte {
+
+namespace {
+
+// Processors on which this process may run, in ascending order
+std::vector<int> availableCpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (0 == sched_getaffinity(0, sizeof(set), &set)) {
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &set)) {
+                cpus.push_back(i);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+} // unnamed namespace
+
+class EventBasePoolImpl final : public EventBasePool {
+public:
+    explicit EventBasePoolImpl(EventBasePoolOptions const& options);
+    ~EventBasePoolImpl();
+
+    size_t size() const override { return members_.size(); }
+    std::shared_ptr<EventBase> get(size_t index) override;
+    std::shared_ptr<EventBase> next() override;
+    std::shared_ptr<EventBase> leastLoaded() override;
+    void release(EventBase *base) override;
+    void stop() override;
+private:
+    bool pin(std::thread &thread, int cpu);
+
+    struct Member {
+        std::shared_ptr<EventBase> base;
+        std::thread thread;
+        // Outstanding `leastLoaded` assignments
+        std::atomic<size_t> load;
+    };
+
+    std::vector<std::unique_ptr<Member>> members_;
+    std::atomic<size_t> next_;
+    std::mutex stopMutex_;
+    bool stopped_;
+};
+
+EventBasePoolImpl::EventBasePoolImpl(EventBasePoolOptions const& options)
+        : next_(0), stopped_(false) {
+    size_t size = options.size;
+    if (size == 0) {
+        size = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Create all bases before starting any thread, so that failures here
+    // need no cleanup
+    for (size_t i = 0; i < size; ++i) {
+        std::unique_ptr<Member> member(new Member());
+        member->base = mkEventBase(options.baseOptions);
+        member->load.store(0, std::memory_order_relaxed);
+        members_.push_back(std::move(member));
+    }
+
+    std::vector<int> cpus;
+    if (options.pinThreads) {
+        cpus = availableCpus();
+    }
+
+    bool pinned = true;
+    // Threads already started must be stopped before a failure propagates;
+    // destroying a joinable thread terminates the process
+    std::exception_ptr failure;
+    try {
+        for (size_t i = 0; i < members_.size(); ++i) {
+            auto base = members_[i]->base;
+            members_[i]->thread = std::thread([base]() {
+                    base->loop(EventBase::LoopMode::FOREVER);
+                });
+            if (!cpus.empty()) {
+                pinned = pin(members_[i]->thread, cpus[i % cpus.size()])
+                    && pinned;
+            }
+        }
+    } catch (...) {
+        failure = std::current_exception();
+    }
+
+    // A deferred no-op only runs once its loop is running; after this,
+    // `stop` cannot race with loop startup
+    for (auto& member : members_) {
+        if (member->thread.joinable()) {
+            member->base->runOnEventLoopAndWait([]() { }, /*defer=*/ true);
+        }
+    }
+
+    if (failure) {
+        stop();
+        std::rethrow_exception(failure);
+    }
+
+    if (!pinned) {
+        stop();
+        throw std::runtime_error("Failed to set thread affinity");
+    }
+}
+
+EventBasePoolImpl::~EventBasePoolImpl() {
+    stop();
+}
+
+bool EventBasePoolImpl::pin(std::thread &thread, int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return 0 == pthread_setaffinity_np(thread.native_handle(), sizeof(set),
+        &set);
+#else
+    (void) thread;
+    (void) cpu;
+    return true;
+#endif
+}
+
+std::shared_ptr<EventBase> EventBasePoolImpl::get(size_t index) {
+    return members_.at(index)->base;
+}
+
+std::shared_ptr<EventBase> EventBasePoolImpl::next() {
+    size_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    return members_[index % members_.size()]->base;
+}
+
+std::shared_ptr<EventBase> EventBasePoolImpl::leastLoaded() {
+    // The scan is not atomic with respect to concurrent selections; the
+    // result is a good choice, not necessarily the best one
+    Member *best = members_[0].get();
+    size_t bestLoad = best->load.load(std::memory_order_relaxed);
+    for (size_t i = 1; i < members_.size() && bestLoad > 0; ++i) {
+        size_t load = members_[i]->load.load(std::memory_order_relaxed);
+        if (load < bestLoad) {
+            best = members_[i].get();
+            bestLoad = load;
+        }
+    }
+    best->load.fetch_add(1, std::memory_order_relaxed);
+    return best->base;
+}
+
+void EventBasePoolImpl::release(EventBase *base) {
+    for (auto& member : members_) {
+        if (member->base.get() == base) {
+            member->load.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    throw std::runtime_error("Event base is not a member of this pool");
+}
+
+void EventBasePoolImpl::stop() {
+    std::lock_guard<std::mutex> lock(stopMutex_);
+    if (stopped_) {
+        return;
+    }
+    stopped_ = true;
+
+    for (auto& member : members_) {
+        if (member->thread.joinable()) {
+            member->base->stop();
+            member->thread.join();
+        }
+    }
+}
+
+std::shared_ptr<EventBasePool> mkEventBasePool(
+        EventBasePoolOptions const& options) {
+    // Using an explicit deleter here ensures that the delete is performed
+    // by this library, avoiding cross-DLL delete issues on Windows.
+    return std::shared_ptr<EventBasePool>(new EventBasePoolImpl(options),
+        std::default_delete<EventBasePool>());
+}
+
+} // wte namespace
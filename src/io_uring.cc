@@ -0,0 +1,248 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "io_uring.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace wte {
+
+namespace {
+
+int sysIoUringSetup(unsigned entries, struct io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sysIoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+        unsigned flags, void *arg, size_t argsz) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+        min_complete, flags, arg, argsz));
+}
+
+template<typename T>
+T* at(void *base, uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+} // unnamed namespace
+
+IoUring::IoUring(unsigned entries) : fd_(-1), sqRing_(MAP_FAILED),
+        sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+        sqeTail_(0), cqRing_(MAP_FAILED) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    const char *error = nullptr;
+    for (;;) {
+        fd_ = sysIoUringSetup(entries, &params);
+        if (fd_ < 0) {
+            error = "Failed to create io_uring";
+            break;
+        }
+
+        // Timed waits are expressed through io_uring_enter's extended
+        // argument rather than timeout entries that would need reaping
+        if (!(params.features & IORING_FEAT_EXT_ARG)) {
+            error = "io_uring lacks IORING_FEAT_EXT_ARG (Linux 5.11+)";
+            break;
+        }
+
+        sqRingSize_ = params.sq_off.array +
+            params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes +
+            params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+
+        sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sqRing_ == MAP_FAILED) {
+            error = "Failed to map io_uring submission ring";
+            break;
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cqRing_ = sqRing_;
+        } else {
+            cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cqRing_ == MAP_FAILED) {
+                error = "Failed to map io_uring completion ring";
+                break;
+            }
+        }
+
+        sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqesSize_,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+            IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            error = "Failed to map io_uring submission entries";
+            break;
+        }
+
+        sqHead_ = at<unsigned>(sqRing_, params.sq_off.head);
+        sqTail_ = at<unsigned>(sqRing_, params.sq_off.tail);
+        sqMask_ = *at<unsigned>(sqRing_, params.sq_off.ring_mask);
+        sqEntries_ = *at<unsigned>(sqRing_, params.sq_off.ring_entries);
+        cqHead_ = at<unsigned>(cqRing_, params.cq_off.head);
+        cqTail_ = at<unsigned>(cqRing_, params.cq_off.tail);
+        cqMask_ = *at<unsigned>(cqRing_, params.cq_off.ring_mask);
+        cqes_ = at<struct io_uring_cqe>(cqRing_, params.cq_off.cqes);
+
+        // Submission slots map one-to-one onto entries
+        unsigned *array = at<unsigned>(sqRing_, params.sq_off.array);
+        for (unsigned i = 0; i < sqEntries_; ++i) {
+            array[i] = i;
+        }
+
+        sqeTail_ = *sqTail_;
+        return;
+    }
+
+    release();
+    throw std::runtime_error(error);
+}
+
+IoUring::~IoUring() {
+    release();
+}
+
+void IoUring::release() {
+    if (sqes_ != MAP_FAILED) {
+        munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_ != MAP_FAILED) {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    cqRing_ = sqRing_ = MAP_FAILED;
+    fd_ = -1;
+}
+
+struct io_uring_sqe* IoUring::next(uint64_t user_data) {
+    bool stalled = false;
+    for (;;) {
+        unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (sqeTail_ - head < sqEntries_) {
+            break;
+        }
+        // Full; hand what we have to the kernel without waiting
+        enter(/*wait=*/ false, -1);
+        if (__atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) != head) {
+            stalled = false;
+            continue;
+        }
+        // Refused (EBUSY) until the completion ring has room. Callbacks
+        // may not run here, so set the completions aside for `reap`, and
+        // have the kernel move any overflowed completions into the ring.
+        size_t moved = stash();
+        sysIoUringEnter(fd_, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+        moved += stash();
+        if (moved == 0) {
+            if (stalled) {
+                throw std::runtime_error("io_uring submission queue stalled");
+            }
+            stalled = true;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &sqes_[sqeTail_ & sqMask_];
+    ++sqeTail_;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+size_t IoUring::stash() {
+    size_t moved = 0;
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head, ++moved) {
+        struct io_uring_cqe *cqe = &cqes_[head & cqMask_];
+        backlog_.push_back(Completion { cqe->user_data, cqe->res });
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return moved;
+}
+
+void IoUring::enter(bool wait, int timeoutMillis) {
+    // Anything the kernel has not consumed, including entries left over
+    // from an interrupted call
+    unsigned toSubmit = sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+
+    if (!backlog_.empty()) {
+        // Stashed completions are ready to reap
+        wait = false;
+    }
+    if (!wait && toSubmit == 0) {
+        return;
+    }
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+
+    unsigned flags = 0;
+    if (wait) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeoutMillis >= 0) {
+            ts.tv_sec = timeoutMillis / 1000;
+            ts.tv_nsec = (timeoutMillis % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    }
+
+    int rc = sysIoUringEnter(fd_, toSubmit, wait ? 1 : 0, flags,
+        wait ? &arg : nullptr, wait ? sizeof(arg) : 0);
+    if (rc < 0) {
+        switch (errno) {
+        case ETIME:
+        case EINTR:
+        case EBUSY:
+        case EAGAIN:
+            // Timed out, interrupted, or the completion ring needs reaping
+            break;
+        default:
+            throw std::runtime_error("io_uring_enter failed");
+        }
+    }
+}
+
+} // wte namespace
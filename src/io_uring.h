@@ -0,0 +1,176 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_IO_URING_H_
+#define SRC_IO_URING_H_
+
+#include <linux/io_uring.h>
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+#include "wte/porting.h"
+
+namespace wte {
+
+/**
+ * An asynchronous operation submitted to an `IoUring`.
+ *
+ * The request's address is the submission's user data; it must remain
+ * live until `complete` is invoked.
+ */
+class IoRequest {
+public:
+    virtual ~IoRequest() { }
+
+    /**
+     * Invoked on the loop thread when the operation completes.
+     *
+     * @param result the operation result, or a negated errno value
+     */
+    virtual void complete(int result) NOEXCEPT = 0;
+};
+
+/**
+ * Minimal io_uring(7) submission and completion ring.
+ *
+ * Entries obtained from `next()` are only made visible to the kernel by
+ * `enter()`, so each loop iteration costs a single system call regardless
+ * of how many operations it queued.
+ */
+class IoUring {
+public:
+    /**
+     * @param entries submission queue size
+     * @throws if the ring cannot be created
+     */
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(IoUring const&) = delete;
+    IoUring& operator=(IoUring const&) = delete;
+
+    /**
+     * Obtain a zeroed submission entry, flushing the queue to the kernel
+     * if it is full.
+     *
+     * If the kernel will not accept submissions until completions are
+     * reaped, available completions are set aside for the next `reap`.
+     *
+     * @param user_data the completion token for the entry
+     * @throws if the queue remains full regardless
+     */
+    struct io_uring_sqe* next(uint64_t user_data);
+
+    /**
+     * Submit queued entries, optionally waiting for a completion.
+     *
+     * @param wait whether to wait for at least one completion
+     * @param timeoutMillis wait bound, or -1 to wait indefinitely
+     */
+    void enter(bool wait, int timeoutMillis);
+
+    /**
+     * Invoke `fn(user_data, result)` for each available completion.
+     *
+     * @return the number of completions reaped
+     */
+    template<typename F>
+    size_t reap(F const& fn);
+private:
+    void release();
+
+    /**
+     * Move available completions out of the ring into `backlog_`.
+     *
+     * @return the number of completions moved
+     */
+    size_t stash();
+
+    struct Completion {
+        uint64_t user_data;
+        int result;
+    };
+
+    int fd_;
+
+    // Submission ring
+    void *sqRing_;
+    size_t sqRingSize_;
+    unsigned *sqHead_;
+    unsigned *sqTail_;
+    unsigned sqMask_;
+    unsigned sqEntries_;
+    struct io_uring_sqe *sqes_;
+    size_t sqesSize_;
+    // Local tail; published to the kernel in `enter`
+    unsigned sqeTail_;
+
+    // Completion ring (may share the submission mapping)
+    void *cqRing_;
+    size_t cqRingSize_;
+    unsigned *cqHead_;
+    unsigned *cqTail_;
+    unsigned cqMask_;
+    struct io_uring_cqe *cqes_;
+    // Completions stashed by `next`, which precede those in the ring
+    std::vector<Completion> backlog_;
+};
+
+template<typename F>
+size_t IoUring::reap(F const& fn) {
+    size_t reaped = 0;
+    for (;;) {
+        if (!backlog_.empty()) {
+            // Callbacks may stash further (later) completions
+            std::vector<Completion> pending;
+            pending.swap(backlog_);
+            for (auto const& completion : pending) {
+                ++reaped;
+                fn(completion.user_data, completion.result);
+            }
+            continue;
+        }
+
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+        struct io_uring_cqe *cqe = &cqes_[head & cqMask_];
+        uint64_t user_data = cqe->user_data;
+        int result = cqe->res;
+
+        // Release the slot before running the callback, which may queue
+        // further work
+        __atomic_store_n(cqHead_, ++head, __ATOMIC_RELEASE);
+        ++reaped;
+
+        fn(user_data, result);
+    }
+    return reaped;
+}
+
+} // wte namespace
+
+#endif // SRC_IO_URING_H_
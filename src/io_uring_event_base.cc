@@ -0,0 +1,419 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "io_uring_event_base.h"
+
+#include <poll.h>
+
+#include <cassert>
+#include <stdexcept>
+
+#include "wte/event_handler.h"
+
+namespace wte {
+
+namespace {
+
+// Submission queue size; the queue is flushed early if it fills
+const unsigned kRingEntries = 256;
+
+// Operations submitted through the public interface are tagged in the low
+// bit of their user data to distinguish them from handler polls. User data
+// of zero marks submissions whose completions are ignored.
+const uint64_t kOperationTag = 1;
+
+uint64_t operationData(IoRequest *req) {
+    return reinterpret_cast<uint64_t>(req) | kOperationTag;
+}
+
+uint32_t toPoll(What what) {
+    switch (what) {
+    case What::READ:
+        return POLLIN;
+    case What::WRITE:
+        return POLLOUT;
+    case What::READ_WRITE:
+        return POLLIN | POLLOUT;
+    default:
+        return 0;
+    }
+}
+
+What fromPoll(uint32_t events, What watched) {
+    // As with the other backends, errors and hangups are reported to
+    // whichever of read and write the handler is watching.
+    bool read = events & (POLLIN | POLLERR | POLLHUP);
+    bool write = events & (POLLOUT | POLLERR | POLLHUP);
+    read = read && isRead(watched);
+    write = write && isWrite(watched);
+
+    if (read && write) {
+        return What::READ_WRITE;
+    } else if (read) {
+        return What::READ;
+    } else if (write) {
+        return What::WRITE;
+    }
+    return What::NONE;
+}
+
+} // unnamed namespace
+
+/**
+ * A one-shot poll on behalf of a handler.
+ *
+ * Allocated separately from the handler so that the handler may be
+ * destroyed while the poll is in flight; the orphaned request is released
+ * when its completion arrives.
+ */
+class IoUringEventBase::PollRequest final : public IoRequest {
+public:
+    PollRequest(IoUringEventBase *base, EventHandler *handler)
+        : base_(base), handler_(handler), removing_(false) { }
+
+    void complete(int result) NOEXCEPT override {
+        base_->pollComplete(this, result);
+    }
+
+    IoUringEventBase *base_;
+    // Null once the handler has been destroyed
+    EventHandler *handler_;
+    // Whether a removal has been submitted for the current poll
+    bool removing_;
+};
+
+UringEventHandler::~UringEventHandler() {
+    if (registered() && !internal_) {
+        --base_->registered_;
+    }
+    if (poll_) {
+        poll_->handler_ = nullptr;
+        if (!poll_->removing_) {
+            base_->removePoll(poll_);
+        }
+    }
+}
+
+IoUringEventBase::IoUringEventBase(EventBaseOptions const& options)
+        : NotifyingEventBase(options), ring_(kRingEntries), breakLoop_(false),
+          registered_(0),
+          inflight_(0), removals_(0), dispatched_(0), closing_(false),
+          timers_(this, options.timerTickMillis) {
+    registerHandlerInternal(notifyHandler(), What::READ, /*internal=*/ true);
+}
+
+IoUringEventBase::~IoUringEventBase() {
+    notifyHandler()->unregister();
+
+    // Operations orphaned by their streams and polls orphaned by their
+    // handlers have been cancelled, but are only released on completion,
+    // and the kernel may write to their buffers until then
+    closing_ = true;
+    while (inflight_ > 0 || removals_ > 0) {
+        ring_.enter(/*wait=*/ true, -1);
+        reap();
+    }
+}
+
+void IoUringEventBase::loop(LoopMode mode) {
+    beginLoop();
+
+    do {
+        if (mode == LoopMode::SPIN) {
+            spin();
+            break;
+        }
+
+        // Always run ops in the notification queue
+        runOpsInQueue();
+
+        bool nonEmpty = dispatch(mode == LoopMode::FOREVER);
+
+        if (mode == LoopMode::ONCE) {
+            break;
+        }
+
+        if (mode == LoopMode::UNTIL_EMPTY && !nonEmpty) {
+            break;
+        }
+    } while (!terminating());
+
+    // Hand off anything queued by the final callbacks
+    ring_.enter(/*wait=*/ false, -1);
+
+    breakLoop_ = false;
+    endLoop();
+}
+
+bool IoUringEventBase::dispatch(bool forever) {
+    if (!forever && registered_ == 0 && inflight_ == 0 && timers_.empty()) {
+        return false;
+    }
+
+    // Like libevent's EVLOOP_ONCE, block until something fires
+    for (;;) {
+        beginWait();
+
+        if (breakLoop_) {
+            breakLoop_ = false;
+            return true;
+        }
+
+        ring_.enter(/*wait=*/ true, timers_.waitMillis());
+        endWait();
+
+        dispatched_ = 0;
+        reap();
+
+        size_t expired = timers_.expire();
+
+        if (dispatched_ > 0 || expired > 0) {
+            return true;
+        }
+    }
+}
+
+size_t IoUringEventBase::poll() {
+    ring_.enter(/*wait=*/ false, -1);
+
+    dispatched_ = 0;
+    reap();
+
+    return dispatched_ + timers_.expire();
+}
+
+void IoUringEventBase::wait() {
+    dispatch(/*forever=*/ true);
+}
+
+void IoUringEventBase::reap() {
+    ring_.reap([this](uint64_t data, int result) {
+            if (data == 0) {
+                // Completion of a removal or cancellation
+                return;
+            }
+            if (data & kOperationTag) {
+                --inflight_;
+                ++dispatched_;
+            }
+            reinterpret_cast<IoRequest*>(data & ~kOperationTag)->complete(
+                result);
+        });
+}
+
+void IoUringEventBase::breakLoop() {
+    breakLoop_ = true;
+}
+
+void IoUringEventBase::armPoll(PollRequest *poll, What what) {
+    struct io_uring_sqe *sqe = ring_.next(reinterpret_cast<uint64_t>(poll));
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = poll->handler_->fd();
+    sqe->poll32_events = toPoll(what);
+}
+
+void IoUringEventBase::removePoll(PollRequest *poll) {
+    struct io_uring_sqe *sqe = ring_.next(0);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(poll);
+    poll->removing_ = true;
+    ++removals_;
+}
+
+void IoUringEventBase::pollComplete(PollRequest *poll, int result) {
+    // A removal cancels the poll; it is re-armed below if still wanted
+    const bool removed = poll->removing_;
+    if (removed) {
+        poll->removing_ = false;
+        --removals_;
+    }
+
+    EventHandler *handler = poll->handler_;
+    if (!handler) {
+        delete poll;
+        return;
+    }
+
+    UringEventHandler *impl = static_cast<UringEventHandler*>(
+        EventHandlerImpl::get(handler));
+    What watched = impl->watched_;
+    if (watched == What::NONE || closing_) {
+        impl->poll_ = nullptr;
+        delete poll;
+        return;
+    }
+
+    if (result < 0 && !removed) {
+        // The descriptor cannot be polled, e.g. it was closed while
+        // registered. A re-armed poll would fail on every iteration, so
+        // unregister the handler and dispatch its interest instead; its own
+        // I/O surfaces the error.
+        impl->poll_ = nullptr;
+        delete poll;
+        if (!impl->internal_) {
+            --registered_;
+        }
+        impl->watched_ = What::NONE;
+        ++dispatched_;
+        handler->ready(watched);
+        return;
+    }
+
+    // Re-arm before dispatch with the current interest. The poll is
+    // evaluated when it is submitted, after the handler has run, so
+    // unconsumed readiness is reported again (level-triggered).
+    armPoll(poll, watched);
+
+    if (result > 0) {
+        What what = fromPoll(result, watched);
+        if (what != What::NONE) {
+            ++dispatched_;
+            handler->ready(what);
+        }
+    }
+}
+
+void IoUringEventBase::registerHandler(EventHandler *handler, What what) {
+    assert(inLoopThread());
+    registerHandlerInternal(handler, what, /*internal event=*/ false);
+}
+
+void IoUringEventBase::registerHandlerInternal(EventHandler *handler,
+        What what, bool internal_event) {
+    if (what == What::NONE) {
+        unregisterHandler(handler);
+        return;
+    }
+
+    UringEventHandler *impl = static_cast<UringEventHandler*>(
+        EventHandlerImpl::get(handler));
+
+    if (impl) {
+        assert(impl->base() == this);
+        if (what == impl->watched_) {
+            // No change
+            return;
+        }
+    } else {
+        impl = new UringEventHandler(this);
+        EventHandlerImpl::set(handler, impl);
+    }
+
+    if (handler->fd() < 0) {
+        throw std::runtime_error("Invalid file descriptor");
+    }
+
+    if (!impl->registered()) {
+        impl->internal_ = internal_event;
+        if (!internal_event) {
+            ++registered_;
+        }
+    }
+    impl->watched_ = what;
+
+    if (!impl->poll_) {
+        impl->poll_ = new PollRequest(this, handler);
+        armPoll(impl->poll_, what);
+    } else if (!impl->poll_->removing_) {
+        // The outstanding poll has stale interest; it is re-armed with the
+        // current interest when the removal completes
+        removePoll(impl->poll_);
+    }
+}
+
+void IoUringEventBase::unregisterHandler(EventHandler *handler) {
+    assert(inLoopThread());
+
+    if (!handler->base()) {
+        return;
+    }
+
+    assert(handler->base() == this);
+
+    UringEventHandler *impl = static_cast<UringEventHandler*>(
+        EventHandlerImpl::get(handler));
+
+    if (!impl->registered()) {
+        return;
+    }
+
+    if (impl->poll_ && !impl->poll_->removing_) {
+        removePoll(impl->poll_);
+    }
+
+    if (!impl->internal_) {
+        --registered_;
+    }
+    impl->watched_ = What::NONE;
+}
+
+void IoUringEventBase::registerTimeout(Timeout *timeout,
+        struct timeval *duration) {
+    assert(inLoopThread());
+    timers_.add(timeout, duration);
+}
+
+void IoUringEventBase::unregisterTimeout(Timeout *timeout) {
+    assert(inLoopThread());
+    timers_.remove(timeout);
+}
+
+void IoUringEventBase::submitRecv(IoRequest *req, int fd, void *buf,
+        size_t len) {
+    struct io_uring_sqe *sqe = ring_.next(operationData(req));
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    ++inflight_;
+}
+
+void IoUringEventBase::submitSendmsg(IoRequest *req, int fd,
+        struct msghdr const *msg) {
+    struct io_uring_sqe *sqe = ring_.next(operationData(req));
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    ++inflight_;
+}
+
+void IoUringEventBase::submitConnect(IoRequest *req, int fd,
+        struct sockaddr const *addr, socklen_t len) {
+    struct io_uring_sqe *sqe = ring_.next(operationData(req));
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->off = len;
+    ++inflight_;
+}
+
+void IoUringEventBase::cancel(IoRequest *req) {
+    struct io_uring_sqe *sqe = ring_.next(0);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = operationData(req);
+}
+
+} // wte namespace
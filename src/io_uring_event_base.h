@@ -0,0 +1,143 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_IO_URING_EVENT_BASE_H_
+#define SRC_IO_URING_EVENT_BASE_H_
+
+#include <sys/socket.h>
+
+#include <cstddef>
+
+#include "event_handler_impl.h"
+#include "io_uring.h"
+#include "notifying_event_base.h"
+#include "timer_wheel.h"
+#include "wte/event_base.h"
+
+namespace wte {
+
+/**
+ * An event base driven by io_uring(7).
+ *
+ * Handler readiness is delivered through one-shot poll requests that are
+ * re-armed after each notification, which preserves the level-triggered
+ * semantics of the other backends. In addition, the base accepts
+ * completion-based socket operations (`submitRecv` and friends), which
+ * `Stream` uses in place of readiness notification plus read/write calls.
+ *
+ * All submissions queued during a loop iteration are handed to the kernel
+ * with the wait for the next completions, in a single system call, and
+ * completions are reaped in bulk.
+ */
+class IoUringEventBase final : public NotifyingEventBase {
+public:
+    explicit IoUringEventBase(EventBaseOptions const& options);
+    ~IoUringEventBase();
+
+    void loop(LoopMode mode) override;
+    void registerHandler(EventHandler*, What) override;
+    void unregisterHandler(EventHandler*) override;
+    void registerTimeout(Timeout *, struct timeval *duration) override;
+    void unregisterTimeout(Timeout *) override;
+
+    /** Queue a receive of up to `len` bytes into `buf`. */
+    void submitRecv(IoRequest *req, int fd, void *buf, size_t len);
+
+    /** Queue a sendmsg(2) of `msg`, which must outlive the operation. */
+    void submitSendmsg(IoRequest *req, int fd, struct msghdr const *msg);
+
+    /** Queue a connect(2) to `addr`, which must outlive the operation. */
+    void submitConnect(IoRequest *req, int fd, struct sockaddr const *addr,
+        socklen_t len);
+
+    /**
+     * Request cancellation of an operation queued by this base.
+     *
+     * The operation's completion is still delivered, typically with
+     * `-ECANCELED`.
+     */
+    void cancel(IoRequest *req);
+
+    class PollRequest;
+protected:
+    void breakLoop() override;
+    // Completions are reaped from the shared ring without a system call
+    size_t poll() override;
+    void wait() override;
+private:
+    friend class PollRequest;
+    friend class UringEventHandler;
+
+    void registerHandlerInternal(EventHandler*, What, bool internal_event);
+
+    void armPoll(PollRequest *poll, What what);
+    void removePoll(PollRequest *poll);
+    void pollComplete(PollRequest *poll, int result);
+
+    /** Dispatch all available completions. */
+    void reap();
+
+    /**
+     * Wait for and dispatch completions and expired timeouts.
+     *
+     * @param forever whether to wait even if nothing is registered
+     * @return false if nothing was registered or in flight on entry
+     */
+    bool dispatch(bool forever);
+
+    IoUring ring_;
+    bool breakLoop_;
+    // Number of registered non-internal handlers
+    size_t registered_;
+    // Number of submitted operations awaiting completion
+    size_t inflight_;
+    // Number of polls with a removal outstanding
+    size_t removals_;
+    // Number of handler and operation callbacks in this dispatch pass
+    size_t dispatched_;
+    // Whether the base is being destroyed
+    bool closing_;
+    TimerWheel timers_;
+};
+
+class UringEventHandler final : public EventHandlerImpl {
+public:
+    explicit UringEventHandler(IoUringEventBase *base)
+        : base_(base), watched_(What::NONE), internal_(false),
+          poll_(nullptr) { }
+    ~UringEventHandler();
+    What watched() override { return watched_; }
+    EventBase* base() override { return base_; }
+    bool registered() override { return watched_ != What::NONE; }
+private:
+    IoUringEventBase *base_;
+    What watched_;
+    bool internal_;
+    // The outstanding poll request, if any
+    IoUringEventBase::PollRequest *poll_;
+
+    friend class IoUringEventBase;
+};
+
+} // wte namespace
+
+#endif // SRC_IO_URING_EVENT_BASE_H_
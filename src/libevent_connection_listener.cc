@@ -21,6 +21,7 @@
 #include "libevent_connection_listener.h"
 
 #include <assert.h>
+#include <errno.h>
 
 #if !defined(_WIN32)
 #include <arpa/inet.h>
@@ -33,6 +34,7 @@
 #include <ws2tcpip.h>
 #endif
 
+#include <stdexcept>
 #include <string>
 
 #include <event2/util.h>
@@ -42,11 +44,62 @@
 
 namespace wte {
 
+namespace {
+
+inline bool isAcceptRetryable(int e) {
+#if !defined(_WIN32)
+    return e == EAGAIN || e == EWOULDBLOCK || e == EINTR ||
+        e == ECONNABORTED;
+#else
+    return e == WSAEWOULDBLOCK || e == WSAEINTR || e == WSAECONNRESET;
+#endif
+}
+
+// Whether an accept failure means that no connections are pending
+inline bool isAcceptQueueEmpty(int e) {
+#if !defined(_WIN32)
+    return e == EAGAIN || e == EWOULDBLOCK;
+#else
+    return e == WSAEWOULDBLOCK;
+#endif
+}
+
+// Accept a connection in non-blocking, close-on-exec mode
+int acceptNonblocking(int fd, struct sockaddr_storage *ss, socklen_t *len) {
+#if defined(__linux__)
+    return accept4(fd, reinterpret_cast<struct sockaddr*>(ss), len,
+        SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int sock = accept(fd, reinterpret_cast<struct sockaddr*>(ss), len);
+    if (sock < 0) {
+        return sock;
+    }
+    if (-1 == evutil_make_socket_nonblocking(sock) ||
+            -1 == evutil_make_socket_closeonexec(sock)) {
+        xclose(sock);
+        return -1;
+    }
+    return sock;
+#endif
+}
+
+} // unnamed namespace
+
 LibeventConnectionListener::LibeventConnectionListener(
         std::shared_ptr<EventBase> base,
         std::function<void(int)> const& acceptCallback,
         std::function<void(std::exception const&)> errorCallback)
-    : base_(base), port_(0), acceptCallback_(acceptCallback),
+    : base_(base), port_(0), reusePort_(false),
+        batchLimit_(kDefaultAcceptBatch), acceptCallback_(acceptCallback),
+        errorCallback_(errorCallback), handler_(this, /*fd=*/ -1) { }
+
+LibeventConnectionListener::LibeventConnectionListener(
+        std::shared_ptr<EventBase> base,
+        std::function<void(std::vector<AcceptedConnection>&)> const&
+            batchCallback,
+        std::function<void(std::exception const&)> errorCallback)
+    : base_(base), port_(0), reusePort_(false),
+        batchLimit_(kDefaultAcceptBatch), batchCallback_(batchCallback),
         errorCallback_(errorCallback), handler_(this, /*fd=*/ -1) { }
 
 LibeventConnectionListener::~LibeventConnectionListener() {
@@ -84,6 +137,19 @@ void LibeventConnectionListener::bind(std::string const& ip_addr,
             break;
         }
 
+        if (reusePort_) {
+#if defined(SO_REUSEPORT)
+            int one = 1;
+            rc = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#else
+            rc = -1;
+#endif
+            if (-1 == rc) {
+                error = "Failed to set SO_REUSEPORT";
+                break;
+            }
+        }
+
         struct sockaddr_in saddr;
         saddr.sin_family = AF_INET;
         rc = inet_pton(AF_INET, ip_addr.c_str(), &saddr.sin_addr);
@@ -132,31 +198,63 @@ void LibeventConnectionListener::listen(int backlog) {
     }
 }
 
-void LibeventConnectionListener::AcceptHandler::ready(What event) NOEXCEPT {
-    auto& handler = listener_->handler_;
+void LibeventConnectionListener::AcceptHandler::ready(What) NOEXCEPT {
+    listener_->acceptBatch();
+}
 
-    // TODO: we could loop this and accept multiple connections in a single
-    // trip through the event handler
-    sockaddr_storage ss;
-    socklen_t len = sizeof(ss);
-    int sock = accept(handler.fd(), reinterpret_cast<struct sockaddr*>(&ss),
-        &len);
-    if (sock < 0) {
-        // TODO: add error-specific message
-        std::runtime_error err("Failed to accept connection");
-        listener_->errorCallback_(err);
-        return;
+void LibeventConnectionListener::acceptBatch() {
+    size_t attempts = 0;
+    bool drained = false;
+    while (batchLimit_ == 0 || attempts < batchLimit_) {
+        ++attempts;
+        AcceptedConnection conn;
+        conn.peerLen = sizeof(conn.peer);
+        conn.fd = acceptNonblocking(handler_.fd(), &conn.peer, &conn.peerLen);
+        if (conn.fd < 0) {
+            int e = evutil_socket_geterror(handler_.fd());
+            if (isAcceptQueueEmpty(e)) {
+                drained = true;
+            } else if (isAcceptRetryable(e)) {
+                // Interrupted, or a queued connection was aborted; others
+                // may still be pending
+                continue;
+            } else {
+                // TODO: add error-specific message
+                std::runtime_error err("Failed to accept connection");
+                errorCallback_(err);
+            }
+            break;
+        }
+
+        if (batchCallback_) {
+            batch_.push_back(conn);
+            continue;
+        }
+
+        acceptCallback_(conn.fd);
+        if (!handler_.registered()) {
+            // The callback stopped accepting
+            return;
+        }
     }
 
-    int rc = evutil_make_socket_nonblocking(sock);
-    if (-1 == rc) {
-        xclose(sock);
-        std::runtime_error err("Failed to make accepted socket non-blocking");
-        listener_->errorCallback_(err);
-        return;
+    if (!batch_.empty()) {
+        batchCallback_(batch_);
+        batch_.clear();
+        if (!handler_.registered()) {
+            return;
+        }
     }
 
-    listener_->acceptCallback_(sock);
+    if (!drained && base_->edgeTriggered()) {
+        // Level-triggered bases report the backlog again on the next loop
+        // iteration, but edge-triggered bases will not until another
+        // connection arrives. Re-adding the descriptor re-evaluates its
+        // readiness, so the remainder is picked up by the next wait, after
+        // the other handlers ready in this one.
+        base_->registerHandler(&handler_, What::NONE);
+        base_->registerHandler(&handler_, What::READ);
+    }
 }
 
 void LibeventConnectionListener::startAccepting() {
@@ -177,4 +275,14 @@ std::shared_ptr<ConnectionListener> mkConnectionListener(
         std::default_delete<ConnectionListener>());
 }
 
+std::shared_ptr<ConnectionListener> mkBatchConnectionListener(
+        std::shared_ptr<EventBase> base,
+        std::function<void(std::vector<AcceptedConnection>&)> const&
+            acceptCallback,
+        std::function<void(std::exception const&)> errorCallback) {
+    return std::shared_ptr<ConnectionListener>(
+        new LibeventConnectionListener(base, acceptCallback, errorCallback),
+        std::default_delete<ConnectionListener>());
+}
+
 } // wte namespace
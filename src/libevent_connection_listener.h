@@ -21,6 +21,9 @@
 #ifndef SRC_LIBEVENT_CONNECTION_LISTENER_H_
 #define SRC_LIBEVENT_CONNECTION_LISTENER_H_
 
+#include <memory>
+#include <vector>
+
 #include "wte/connection_listener.h"
 
 #include "wte/event_handler.h"
@@ -35,6 +38,10 @@ public:
     LibeventConnectionListener(std::shared_ptr<EventBase> loop,
         std::function<void(int)> const& acceptCallback,
         std::function<void(std::exception const&)> errorCallback);
+    LibeventConnectionListener(std::shared_ptr<EventBase> loop,
+        std::function<void(std::vector<AcceptedConnection>&)> const&
+            batchCallback,
+        std::function<void(std::exception const&)> errorCallback);
     ~LibeventConnectionListener();
 
     void bind(uint16_t port) override;
@@ -43,7 +50,20 @@ public:
     void startAccepting() override;
     void stopAccepting() override;
     uint16_t port() override { return port_; }
+    void setAcceptBatchLimit(size_t limit) override { batchLimit_ = limit; }
+
+    /**
+     * Set SO_REUSEPORT on the listening socket, allowing several listeners
+     * to bind the same address. Must be invoked before `bind`.
+     */
+    void setReusePort(bool reuse) { reusePort_ = reuse; }
+
+    /** @return the listening socket, or -1 prior to `bind`. */
+    int fd() { return handler_.fd(); }
 private:
+    // Accept up to the batch limit, dispatching to the callbacks
+    void acceptBatch();
+
     class AcceptHandler final : public EventHandler {
     public:
         AcceptHandler(LibeventConnectionListener *listener, int fd)
@@ -55,7 +75,11 @@ private:
 
     std::shared_ptr<EventBase> base_;
     uint16_t port_;
+    bool reusePort_;
+    size_t batchLimit_;
     std::function<void(int)> acceptCallback_;
+    std::function<void(std::vector<AcceptedConnection>&)> batchCallback_;
+    std::vector<AcceptedConnection> batch_;
     std::function<void(std::exception const&)> errorCallback_;
     AcceptHandler handler_;
 };
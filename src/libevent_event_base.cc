@@ -18,182 +18,110 @@
  * SOFTWARE.
  */
 
-#include <string.h>
-
-#if !defined(_WIN32)
-#include <pthread.h>
-#include <unistd.h>
-#else
-#include <io.h>
-#endif
-
-#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cinttypes>
-#include <condition_variable>
-#include <mutex>
+#include <stdexcept>
 
 #include <event2/event.h>
 #include <event2/event_struct.h>
 
+#if defined(HAVE_EPOLL)
+#include "epoll_event_base.h"
+#endif
 #include "event_handler_impl.h"
+#if defined(HAVE_IO_URING)
+#include "io_uring_event_base.h"
+#endif
 #include "libevent_event_handler.h"
-#include "mpsc_queue.h"
-#include "timeout_impl.h"
+#include "notifying_event_base.h"
+#include "timer_wheel.h"
 #include "wte/event_base.h"
 #include "wte/event_handler.h"
 #include "wte/porting.h"
 #include "wte/timeout.h"
-#include "xplat-io.h"
 
 namespace wte {
 
-namespace { struct NotifyInit; }
-
-class LibeventEventBase final : public EventBase {
+class LibeventEventBase final : public NotifyingEventBase {
 public:
-    LibeventEventBase();
+    explicit LibeventEventBase(EventBaseOptions const& options);
     ~LibeventEventBase();
 
     void loop(LoopMode mode) override;
-    void stop() override;
     void registerHandler(EventHandler*, What) override;
     void unregisterHandler(EventHandler*) override;
-    bool runOnEventLoop(std::function<void(void)> const& op,
-        bool defer) override;
-    bool runOnEventLoopAndWait(std::function<void(void)> const& op,
-        bool defer) override;
     void registerTimeout(Timeout *, struct timeval *duration) override;
     void unregisterTimeout(Timeout *) override;
-
-    class NotifyHandler final : public EventHandler {
-    public:
-        NotifyHandler(LibeventEventBase *base, int fd)
-                : EventHandler(fd), base_(base) { }
-        void ready(What event) NOEXCEPT {
-            switch (event) {
-            case What::READ:
-                base_->receiveNotifications();
-                break;
-            default:
-                // XXX log?
-                break;
-            }
-        }
-    private:
-        LibeventEventBase *base_;
-    };
-
-    struct Notify {
-        enum class Type { PIPE, SOCKETPAIR, EVENTFD };
-        Type type;
-        ConcurrentMPSCQueue<std::function<void(void)>> queue;
-        // Listen on 0, write on 1 (except eventfd, which is both on 1)
-        int fds[2];
-        NotifyHandler handler;
-        explicit Notify(LibeventEventBase *base, NotifyInit const&);
-    };
+protected:
+    void breakLoop() override;
+    size_t poll() override;
+    void wait() override;
+    void notified() override;
 private:
-    void receiveNotifications();
-    void runOpsInQueue();
-    bool consumeNotification();
-    bool signalNotifyQueue();
-
-    // In the loop thread or loop is not running
-    bool inLoopThread();
-
-    // In the loop thread
-    bool inRunningLoopThread();
-
     void registerHandlerInternal(EventHandler*, What, bool internal_event);
 
-    event_base *base_;
-    std::atomic<bool> terminate_;
-#if !defined(_WIN32)
-    std::atomic<pthread_t> loopThread_;
-#else
-    std::atomic<HANDLE> loopThread_;
-#endif
+    static void handlerCallback(evutil_socket_t, int16_t flags, void *ctx);
 
-    struct {
-        std::mutex mutex;
-        std::condition_variable cv;
-        bool finished = false;
-    } await_;
+    static event_base* newBase();
+    static void timerCallback(evutil_socket_t, int16_t, void *ctx);
 
-    struct Notify notify_;
-};
-
-namespace {
-
-class LibeventTimeout final : public TimeoutImpl {
-public:
-    explicit LibeventTimeout(LibeventEventBase *base) : base_(base) {
-        memset(&event_, 0, sizeof(event_));
-    }
-    EventBase* base() override { return base_; }
-
-    LibeventEventBase *base_ = nullptr;
-    struct event event_;
-    bool registered_ = false;
-};
+    /**
+     * Arm the libevent timer for the wheel's next deadline.
+     *
+     * The timer is only moved earlier; a later deadline just costs a
+     * spurious wakeup, after which it is rescheduled.
+     */
+    void scheduleTimer();
 
-// Sigh.
-struct NotifyInit {
-    int fds[2];
-    LibeventEventBase::Notify::Type type;
+    event_base *base_;
+    // Timeouts are kept in the wheel, which is driven by a single
+    // libevent timer; it counts as a registered event while armed
+    TimerWheel timers_;
+    struct event timer_;
+    bool timerArmed_;
+    TimerWheel::Clock::time_point timerDeadline_;
+    // Callbacks dispatched by the current `poll`
+    size_t dispatched_;
+    // Whether `wait` is blocked in libevent
+    bool waiting_;
 };
 
-NotifyInit initNotify() {
-    NotifyInit ret;
-
-    ret.fds[0] = ret.fds[1] = -1;
-
-    int rc = 0;
-#if defined(HAVE_EVENTFD)
-    ret.type = LibeventEventBase::Notify::Type::EVENTFD;
-    ret.fds[0] = eventfd(0, EFD_CLOEXEC);
-    if (ret.fds[0] < 0) {
-        rc = -1;
-    }
-#elif !defined(_WIN32)
-    ret.type = LibeventEventBase::Notify::Type::PIPE;
-    rc = pipe(ret.fds);
+event_base* LibeventEventBase::newBase() {
+#if defined(EVENT__NUMERIC_VERSION) && EVENT__NUMERIC_VERSION >= 0x02010000
+    // The default coarse monotonic clock may fire the timer ahead of the
+    // wheel's deadline
+    event_config *config = event_config_new();
+    if (!config) {
+        throw std::runtime_error("Failed to configure event base");
+    }
+    event_config_set_flag(config, EVENT_BASE_FLAG_PRECISE_TIMER);
+    event_base *base = event_base_new_with_config(config);
+    event_config_free(config);
 #else
-    ret.type = LibeventEventBase::Notify::Type::SOCKETPAIR;
-    rc = evutil_socketpair(AF_INET, SOCK_STREAM, 0, ret.fds);
+    event_base *base = event_base_new();
 #endif
-    if (rc) {
-        throw std::runtime_error("Error configuring notification descriptors");
+    if (!base) {
+        throw std::runtime_error("Failed to create event base");
     }
-    return ret;
+    return base;
 }
-} // unnamed namespace
 
-LibeventEventBase::LibeventEventBase() : base_(event_base_new()),
-        terminate_(false), loopThread_(0), notify_(this, initNotify()) {
-    registerHandlerInternal(&notify_.handler, What::READ, /*internal=*/ true);
-}
-
-LibeventEventBase::Notify::Notify(LibeventEventBase *base,
-            NotifyInit const& init)
-        : handler(base, init.fds[0]) {
-    fds[0] = init.fds[0];
-    fds[1] = init.fds[1];
-    type = init.type;
+LibeventEventBase::LibeventEventBase(EventBaseOptions const& options)
+        : NotifyingEventBase(options), base_(newBase()),
+          timers_(this, options.timerTickMillis),
+          timerArmed_(false), dispatched_(0), waiting_(false) {
+    event_assign(&timer_, base_, -1, 0, timerCallback, this);
+    registerHandlerInternal(notifyHandler(), What::READ, /*internal=*/ true);
 }
 
 LibeventEventBase::~LibeventEventBase() {
-    notify_.handler.unregister();
-
-    event_base_free(base_);
+    notifyHandler()->unregister();
 
-    if (notify_.fds[0] > 0) {
-        xclose(notify_.fds[0]);
-    }
-    if (notify_.fds[1] > 0) {
-        xclose(notify_.fds[1]);
+    if (timerArmed_) {
+        event_del(&timer_);
     }
+    event_base_free(base_);
 }
 
 namespace {
@@ -212,44 +140,15 @@ int toFlags(What what) {
     }
 }
 
-void libeventCallback(evutil_socket_t fd, int16_t flags, void *ctx) {
-    reinterpret_cast<EventHandler*>(ctx)->ready(fromFlags(flags));
-}
-
-void libeventTimeout(evutil_socket_t fd, int16_t flags, void *ctx) {
-    reinterpret_cast<Timeout*>(ctx)->expired();
-}
-
 } // unnamed namespace
 
-bool LibeventEventBase::inLoopThread() {
-    // Acquire order is only required because this check is used to test whether
-    // a loop is running because of the zero comparison. Otherwise, relaxed
-    // order would be sufficient: if the caller is the loop-driving thread,
-    // the value was written by the current thread (by definition); otherwise,
-    // either the current thread assigned the value to zero on the way out of
-    // the loop, or by definition the value is != us.
-    auto cur = loopThread_.load(std::memory_order_acquire);
-#if !defined(_WIN32)
-    return cur == 0 || pthread_equal(cur, pthread_self());
-#else
-    return cur == 0 || cur == GetCurrentThread();
-#endif
-}
-
 void LibeventEventBase::loop(LoopMode mode) {
     struct event persistent_timer;
     int rc = 0;
 
-#if !defined(_WIN32)
-    loopThread_.store(pthread_self(), std::memory_order_release);
-#else
-    loopThread_.store(GetCurrentThread(), std::memory_order_release);
-#endif
+    beginLoop();
 
-    await_.finished = false;
-
-    if (mode == LoopMode::FOREVER) {
+    if (mode == LoopMode::FOREVER || mode == LoopMode::SPIN) {
         // Enqueue a persistent event for versions of libevent that
         // don't support EVLOOP_NO_EXIT_ON_EMPTY
         static struct timeval tv = { 3600, 0 };
@@ -261,9 +160,17 @@ void LibeventEventBase::loop(LoopMode mode) {
     }
 
     do {
+        if (mode == LoopMode::SPIN) {
+            spin();
+            break;
+        }
+
         // Always run ops in the notification queue
         runOpsInQueue();
 
+        // There is no hook for libevent's return from its wait, so producers
+        // keep notifying until the loop next drains the queue
+        beginWait();
         rc = event_base_loop(base_, EVLOOP_ONCE);
         // event_base_loop can exit prematurely; for example, the Windows
         // select-based backend may terminate if the network interfaces
@@ -278,148 +185,39 @@ void LibeventEventBase::loop(LoopMode mode) {
             // rc == 1 means that libevent has no more registered entries
             break;
         }
-    } while (!terminate_.load(std::memory_order_acquire));
+    } while (!terminating());
 
-    if (mode == LoopMode::FOREVER) {
+    if (mode == LoopMode::FOREVER || mode == LoopMode::SPIN) {
         if (-1 == event_del(&persistent_timer)) {
             assert(0);
         }
     }
 
-    // Reset the termination flag on the way out
-    terminate_.store(false, std::memory_order_release);
-    loopThread_.store(0, std::memory_order_release);
-
-    {
-        // Notify waiters
-        std::lock_guard<std::mutex> lock(await_.mutex);
-        await_.finished = true;
-        await_.cv.notify_all();
-    }
+    endLoop();
 }
 
-bool LibeventEventBase::runOnEventLoop(std::function<void(void)> const& op,
-        bool defer) {
-    if (!defer && inLoopThread()) {
-        op();
-        return true;
-    }
-
-    bool shouldKick = notify_.queue.push(op);
-
-    if (shouldKick) {
-        return signalNotifyQueue();
-    }
-
-    return true;
+void LibeventEventBase::breakLoop() {
+    event_base_loopexit(base_, nullptr);
 }
 
-bool LibeventEventBase::runOnEventLoopAndWait(
-        std::function<void(void)> const& op, bool defer) {
-    if (!defer && inLoopThread()) {
-        op();
-        return true;
-    }
-
-    bool done = false;
-    std::mutex mutex;
-    std::condition_variable cv;
-
-    bool scheduled = runOnEventLoop([&]() -> void {
-            op();
-            {
-                std::lock_guard<std::mutex> lock(mutex);
-                done = true;
-                cv.notify_one();
-            }
-        }, defer);
-    if (!scheduled) {
-        return false;
-    }
-
-    // Await completion
-    std::unique_lock<std::mutex> lock(mutex);
-    cv.wait(lock, [&done]() -> bool { return done; });
-
-    return true;
-}
-
-bool LibeventEventBase::consumeNotification() {
-    int rbytes;
-    uint64_t val = 0;
-    uint64_t val8 = 0;
-
-    switch (notify_.type) {
-    case Notify::Type::EVENTFD:
-        rbytes = xread(notify_.fds[0], &val, sizeof(val));
-        break;
-    default:
-        rbytes = xread(notify_.fds[0], &val8, sizeof(val8));
-    }
-    if (rbytes <= 0) {
-        return false;
-    }
-    return true;
-}
-
-bool LibeventEventBase::signalNotifyQueue() {
-    // Make 64 bits available for eventfd-based notification queues
-    const uint8_t buf[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };
-    int ret = 0;
-    switch (notify_.type) {
-    case Notify::Type::PIPE:
-    case Notify::Type::SOCKETPAIR:
-        ret = xwrite(notify_.fds[1], buf, 1);
-        break;
-    case Notify::Type::EVENTFD:
-#if defined(HAVE_EVENTFD)
-        ret = xwrite(notify_.fds[0], sizeof(buf));
-#else
-        assert(0 && "eventfd not supported");
-        ret = -1;
-#endif
-    }
-
-    if (ret <= 0) {
-        return false;
-    }
-    return true;
-}
-
-void LibeventEventBase::receiveNotifications() {
-    // Consume one event from the notification queue. There may be more,
-    // but the event is level-triggered and we'll wake up again and
-    // consume them.
-    bool consumed = consumeNotification();
-    if (!consumed) {
-        // XXX log?
-        return;
-    }
-
-    runOpsInQueue();
+size_t LibeventEventBase::poll() {
+    dispatched_ = 0;
+    event_base_loop(base_, EVLOOP_NONBLOCK);
+    return dispatched_;
 }
 
-void LibeventEventBase::runOpsInQueue() {
-    // Execute all available messages
-    for (;;) {
-        auto op = notify_.queue.pop();
-        if (!op) {
-            // Empty
-            break;
-        }
-        op.value()();
-    }
+void LibeventEventBase::wait() {
+    beginWait();
+    waiting_ = true;
+    event_base_loop(base_, EVLOOP_ONCE);
+    waiting_ = false;
 }
 
-void LibeventEventBase::stop() {
-    runOnEventLoop([this]() -> void {
-        terminate_.store(true, std::memory_order_release);
-        event_base_loopexit(base_, nullptr);
-    }, /*defer=*/ false);
-
-    {
-        std::unique_lock<std::mutex> lock(await_.mutex);
-        await_.cv.wait(lock, [this]() { return await_.finished; });
+void LibeventEventBase::notified() {
+    // The notification event is internal, so it would not otherwise end
+    // the wait; resume spinning instead
+    if (waiting_) {
+        event_base_loopbreak(base_);
     }
 }
 
@@ -446,50 +244,57 @@ void LibeventEventBase::unregisterHandler(EventHandler *handler) {
 void LibeventEventBase::registerTimeout(Timeout *timeout,
         struct timeval *duration) {
     assert(inLoopThread());
+    timers_.add(timeout, duration);
+    scheduleTimer();
+}
 
-    LibeventTimeout *ltime = nullptr;
-    {
-        auto* impl = TimeoutImpl::get(timeout);
-        if (!impl) {
-            ltime = new LibeventTimeout(this);
-            TimeoutImpl::set(timeout, ltime);
-        } else {
-            ltime = reinterpret_cast<LibeventTimeout*>(impl);
-        }
-    }
-
-    if (ltime->registered_) {
-        event_del(&ltime->event_);
+void LibeventEventBase::unregisterTimeout(Timeout *timeout) {
+    assert(inLoopThread());
+    timers_.remove(timeout);
+    if (timers_.empty() && timerArmed_) {
+        // Let UNTIL_EMPTY loops observe that nothing is left
+        event_del(&timer_);
+        timerArmed_ = false;
     }
+}
 
-    // TODO: error checking & throw
-    event_assign(&ltime->event_, base_, -1, 0, libeventTimeout, timeout);
-    event_add(&ltime->event_, duration);
-
-    ltime->registered_ = true;
+void LibeventEventBase::timerCallback(evutil_socket_t, int16_t, void *ctx) {
+    LibeventEventBase *base = reinterpret_cast<LibeventEventBase*>(ctx);
+    base->timerArmed_ = false;
+    base->dispatched_ += base->timers_.expire();
+    base->scheduleTimer();
 }
 
-void LibeventEventBase::unregisterTimeout(Timeout *timeout) {
-    assert(inLoopThread());
+void LibeventEventBase::handlerCallback(evutil_socket_t, int16_t flags,
+        void *ctx) {
+    EventHandler *handler = reinterpret_cast<EventHandler*>(ctx);
+    // Counted up front; the handler may be destroyed by its callback
+    ++static_cast<LibeventEventBase*>(handler->base())->dispatched_;
+    handler->ready(fromFlags(flags));
+}
 
-    auto* impl = TimeoutImpl::get(timeout);
-    if (!impl) {
+void LibeventEventBase::scheduleTimer() {
+    int wait = timers_.waitMillis();
+    if (wait < 0) {
+        if (timerArmed_) {
+            event_del(&timer_);
+            timerArmed_ = false;
+        }
         return;
     }
 
-    if (!impl->base()) {
+    auto deadline = TimerWheel::Clock::now() + std::chrono::milliseconds(wait);
+    if (timerArmed_ && timerDeadline_ <= deadline) {
         return;
     }
 
-    assert(impl->base() == this);
-
-    LibeventTimeout* limpl = reinterpret_cast<LibeventTimeout*>(impl);
-
-    if (!limpl->registered_) {
-        return;
+    // Re-adding a pending event reschedules it
+    struct timeval tv = { wait / 1000, (wait % 1000) * 1000 };
+    if (0 != event_add(&timer_, &tv)) {
+        throw std::runtime_error("Failed to schedule timer");
     }
-    event_del(&limpl->event_);
-    limpl->registered_ = false;
+    timerArmed_ = true;
+    timerDeadline_ = deadline;
 }
 
 void LibeventEventBase::registerHandler(EventHandler *handler, What what) {
@@ -526,7 +331,7 @@ void LibeventEventBase::registerHandlerInternal(EventHandler *handler,
     }
 
     event_assign(&impl->event_, base_, handler->fd(),
-        toFlags(what) | EV_PERSIST, libeventCallback, handler);
+        toFlags(what) | EV_PERSIST, handlerCallback, handler);
     if (internal_event) {
         // The inter-base notification channel has a registered event on the
         // base. We need to mark this internal so that it doesn't count against
@@ -535,7 +340,11 @@ void LibeventEventBase::registerHandlerInternal(EventHandler *handler,
         // alternative would be to maintain a count of registered internal
         // events and break out of the loop when we get down to zero (since
         // we always drive the loop manually).
+#if defined(EVENT__NUMERIC_VERSION) && EVENT__NUMERIC_VERSION >= 0x02010000
+        impl->event_.ev_evcallback.evcb_flags |= EVLIST_INTERNAL;
+#else
         impl->event_.ev_flags |= EVLIST_INTERNAL;
+#endif
     }
 
     impl->registered_ = true;
@@ -544,10 +353,34 @@ void LibeventEventBase::registerHandlerInternal(EventHandler *handler,
 }
 
 std::shared_ptr<EventBase> mkEventBase() {
+    return mkEventBase(EventBaseOptions());
+}
+
+std::shared_ptr<EventBase> mkEventBase(EventBaseOptions const& options) {
+    EventBase *base = nullptr;
+    switch (options.backend) {
+    case Backend::LIBEVENT:
+        base = new LibeventEventBase(options);
+        break;
+    case Backend::EPOLL:
+#if defined(HAVE_EPOLL)
+        base = new EpollEventBase(options);
+        break;
+#else
+        throw std::runtime_error("epoll is not supported on this platform");
+#endif
+    case Backend::IO_URING:
+#if defined(HAVE_IO_URING)
+        base = new IoUringEventBase(options);
+        break;
+#else
+        throw std::runtime_error("io_uring is not supported on this platform");
+#endif
+    }
+
     // Using an explicit deleter here ensures that the delete is performed
     // by this library, avoiding cross-DLL delete issues on Windows.
-    return std::shared_ptr<EventBase>(
-        new LibeventEventBase(), std::default_delete<EventBase>());
+    return std::shared_ptr<EventBase>(base, std::default_delete<EventBase>());
 }
 
 } // wte namespace
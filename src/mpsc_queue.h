@@ -24,6 +24,10 @@
 #define SRC_MPSC_QUEUE_H_
 
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
 
 #include "cache_aligned.h"
 #include "optional.h"
@@ -58,6 +62,14 @@ public:
     /** Pop the next element off the queue. */
     Optional<T> pop();
 
+    /**
+     * @return whether `pop` would fail. Only valid from the consumer.
+     */
+    bool empty() const {
+        return !tail_.load(std::memory_order_relaxed)->next.load(
+            std::memory_order_acquire);
+    }
+
     /**
      * Enqueue an item.
      *
@@ -135,6 +147,169 @@ Optional<T> ConcurrentMPSCQueue<T>::pop() {
     return Optional<T>(std::move(next->data));
 }
 
+/** Outcome of a push onto a `BoundedMPSCQueue`. */
+enum class PushResult {
+    /** Enqueued; the consumer may have observed an empty queue. */
+    EMPTY,
+    /** Enqueued behind elements that the consumer has yet to pop. */
+    NONEMPTY,
+    /** Not enqueued, because the queue is at capacity. */
+    FULL,
+};
+
+/**
+ * A bounded, array-backed, multi-producer, single-consumer FIFO queue.
+ *
+ * This is Dmitry Vyukov's bounded MPMC queue (bit.ly/vyukov-bounded-mpmc)
+ * specialized for a single consumer. Each slot carries a sequence number
+ * that tells producers and the consumer whose turn it is, so pushes and
+ * pops never allocate. Producers contend only on the enqueue position.
+ *
+ * Like `ConcurrentMPSCQueue`, a push reports whether the consumer may have
+ * observed the queue empty, and so needs a "work available" notification.
+ * A push onto a full queue fails, leaving the item with the caller.
+ */
+template<typename T>
+class BoundedMPSCQueue {
+public:
+    /** @param capacity the maximum size; rounded up to a power of two. */
+    explicit BoundedMPSCQueue(size_t capacity);
+    ~BoundedMPSCQueue();
+
+    BoundedMPSCQueue(BoundedMPSCQueue const&) = delete;
+    BoundedMPSCQueue& operator=(BoundedMPSCQueue const&) = delete;
+
+    /** Pop the next element off the queue. */
+    Optional<T> pop();
+
+    /**
+     * @return whether `pop` would fail. Only valid from the consumer.
+     */
+    bool empty() const {
+        size_t pos = dequeue_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) !=
+            pos + 1;
+    }
+
+    /**
+     * Enqueue an item.
+     *
+     * The item is only moved from if it was enqueued.
+     */
+    PushResult push(T const& item);
+    PushResult push(T && item);
+
+    /** @return the maximum number of elements. */
+    size_t capacity() const { return mask_ + 1; }
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(T),
+            std::alignment_of<T>::value>::type storage;
+    };
+
+    static size_t roundCapacity(size_t capacity) {
+        size_t ret = 2;
+        while (ret < capacity) {
+            ret <<= 1;
+        }
+        return ret;
+    }
+
+    Cell *cells_;
+    const size_t mask_;
+    // Claimed by producers
+    std::atomic<size_t> enqueue_;
+    char pad_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    // Only advanced by the consumer; read by producers to detect emptiness
+    std::atomic<size_t> dequeue_;
+};
+
+template<typename T>
+BoundedMPSCQueue<T>::BoundedMPSCQueue(size_t capacity)
+        : cells_(nullptr), mask_(roundCapacity(capacity) - 1), enqueue_(0),
+          dequeue_(0) {
+    cells_ = static_cast<Cell*>(allocateAligned((mask_ + 1) * sizeof(Cell),
+        CACHE_LINE_SIZE));
+    for (size_t i = 0; i <= mask_; ++i) {
+        ::new(&cells_[i].sequence) std::atomic<size_t>(i);
+    }
+}
+
+template<typename T>
+BoundedMPSCQueue<T>::~BoundedMPSCQueue() {
+    while (this->pop()) { }
+    deallocateAligned(cells_);
+}
+
+template<typename T>
+PushResult BoundedMPSCQueue<T>::push(T const& item) {
+    T copy(item);
+    return push(std::move(copy));
+}
+
+template<typename T>
+PushResult BoundedMPSCQueue<T>::push(T && item) {
+    size_t pos = enqueue_.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            // The slot is free for this position; try to claim it
+            if (enqueue_.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer has yet to pop this slot's previous occupant
+            return PushResult::FULL;
+        } else {
+            // Another producer claimed the slot
+            pos = enqueue_.load(std::memory_order_relaxed);
+        }
+    }
+
+    ::new(&cell->storage) T(std::move(item));
+
+    // Publish to the consumer
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the fence in `pop`: either the consumer observes this
+    // element, or we observe that it has caught up to (and may be waiting
+    // on) our position.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (dequeue_.load(std::memory_order_relaxed) == pos) {
+        return PushResult::EMPTY;
+    }
+    return PushResult::NONEMPTY;
+}
+
+template<typename T>
+Optional<T> BoundedMPSCQueue<T>::pop() {
+    // Only the consumer updates dequeue_
+    size_t pos = dequeue_.load(std::memory_order_relaxed);
+    Cell *cell = &cells_[pos & mask_];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+
+    if (seq != pos + 1) {
+        // Empty, or the producer of this slot has yet to publish
+        return Optional<T>();
+    }
+
+    T *value = reinterpret_cast<T*>(&cell->storage);
+    Optional<T> ret(std::move(*value));
+    value->~T();
+
+    // Release the slot to producers for the next lap
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+
+    dequeue_.store(pos + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return ret;
+}
+
 } // wte namespace
 
 #endif // SRC_MPSC_QUEUE_H_
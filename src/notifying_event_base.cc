@@ -0,0 +1,331 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "notifying_event_base.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include <cassert>
+#include <cinttypes>
+#include <stdexcept>
+#include <thread>
+
+#include <event2/util.h>
+
+#include "xplat-io.h"
+
+namespace wte {
+
+// Sigh.
+struct NotifyingEventBase::NotifyInit {
+    int fds[2];
+    NotifyingEventBase::Notify::Type type;
+};
+
+NotifyingEventBase::NotifyInit NotifyingEventBase::initNotify() {
+    NotifyInit ret;
+
+    ret.fds[0] = ret.fds[1] = -1;
+
+    int rc = 0;
+#if defined(HAVE_EVENTFD)
+    ret.type = Notify::Type::EVENTFD;
+    ret.fds[0] = eventfd(0, EFD_CLOEXEC);
+    if (ret.fds[0] < 0) {
+        rc = -1;
+    }
+#elif !defined(_WIN32)
+    ret.type = Notify::Type::PIPE;
+    rc = pipe(ret.fds);
+#else
+    ret.type = Notify::Type::SOCKETPAIR;
+    rc = evutil_socketpair(AF_INET, SOCK_STREAM, 0, ret.fds);
+#endif
+    if (rc) {
+        throw std::runtime_error("Error configuring notification descriptors");
+    }
+    return ret;
+}
+
+NotifyingEventBase::NotifyingEventBase(EventBaseOptions const& options)
+        : terminate_(false), wakeState_(WakeState::SLEEPING),
+          spinIdle_(options.spinIdleMicros), loopThread_(0),
+          notify_(this, initNotify(), options.notifyQueueCapacity) { }
+
+NotifyingEventBase::Notify::Notify(NotifyingEventBase *base,
+            NotifyInit const& init, size_t capacity)
+        : handler(base, init.fds[0]) {
+    fds[0] = init.fds[0];
+    fds[1] = init.fds[1];
+    type = init.type;
+    if (capacity > 0) {
+        ring.reset(new BoundedMPSCQueue<Task>(capacity));
+    }
+}
+
+NotifyingEventBase::~NotifyingEventBase() {
+    if (notify_.fds[0] > 0) {
+        xclose(notify_.fds[0]);
+    }
+    if (notify_.fds[1] > 0) {
+        xclose(notify_.fds[1]);
+    }
+}
+
+bool NotifyingEventBase::inLoopThread() {
+    // Acquire order is only required because this check is used to test whether
+    // a loop is running because of the zero comparison. Otherwise, relaxed
+    // order would be sufficient: if the caller is the loop-driving thread,
+    // the value was written by the current thread (by definition); otherwise,
+    // either the current thread assigned the value to zero on the way out of
+    // the loop, or by definition the value is != us.
+    auto cur = loopThread_.load(std::memory_order_acquire);
+#if !defined(_WIN32)
+    return cur == 0 || pthread_equal(cur, pthread_self());
+#else
+    return cur == 0 || cur == GetCurrentThread();
+#endif
+}
+
+void NotifyingEventBase::beginLoop() {
+#if !defined(_WIN32)
+    loopThread_.store(pthread_self(), std::memory_order_release);
+#else
+    loopThread_.store(GetCurrentThread(), std::memory_order_release);
+#endif
+
+    await_.finished = false;
+}
+
+void NotifyingEventBase::endLoop() {
+    // Reset the termination flag on the way out
+    terminate_.store(false, std::memory_order_release);
+    loopThread_.store(0, std::memory_order_release);
+
+    {
+        // Notify waiters
+        std::lock_guard<std::mutex> lock(await_.mutex);
+        await_.finished = true;
+        await_.cv.notify_all();
+    }
+}
+
+bool NotifyingEventBase::runOnEventLoop(Task && op, bool defer) {
+    if (!defer && inLoopThread()) {
+        op();
+        return true;
+    }
+
+    bool shouldKick;
+    if (notify_.ring) {
+        PushResult result = notify_.ring->push(std::move(op));
+        if (result == PushResult::FULL) {
+            return false;
+        }
+        shouldKick = result == PushResult::EMPTY;
+    } else {
+        shouldKick = notify_.queue.push(std::move(op));
+    }
+
+    if (shouldKick) {
+        // Pairs with the fence in `beginWait`: either the loop observes
+        // the operation before blocking, or we observe that it is asleep.
+        // Only the first producer to do so pays for the notification.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        WakeState expected = WakeState::SLEEPING;
+        shouldKick = wakeState_.compare_exchange_strong(expected,
+            WakeState::NOTIFIED, std::memory_order_relaxed);
+    }
+
+    if (shouldKick) {
+        return signalNotifyQueue();
+    }
+
+    return true;
+}
+
+bool NotifyingEventBase::runOnEventLoopAndWait(Task && op, bool defer) {
+    if (!defer && inLoopThread()) {
+        op();
+        return true;
+    }
+
+    bool done = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    bool scheduled = runOnEventLoop([&]() -> void {
+            op();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+                cv.notify_one();
+            }
+        }, defer);
+    if (!scheduled) {
+        return false;
+    }
+
+    // Await completion
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&done]() -> bool { return done; });
+
+    return true;
+}
+
+bool NotifyingEventBase::consumeNotification() {
+    int rbytes;
+    uint64_t val = 0;
+    uint64_t val8 = 0;
+
+    switch (notify_.type) {
+    case Notify::Type::EVENTFD:
+        rbytes = xread(notify_.fds[0], &val, sizeof(val));
+        break;
+    default:
+        rbytes = xread(notify_.fds[0], &val8, sizeof(val8));
+    }
+    if (rbytes <= 0) {
+        return false;
+    }
+    return true;
+}
+
+bool NotifyingEventBase::signalNotifyQueue() {
+    // Make 64 bits available for eventfd-based notification queues
+    const uint8_t buf[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+    int ret = 0;
+    switch (notify_.type) {
+    case Notify::Type::PIPE:
+    case Notify::Type::SOCKETPAIR:
+        ret = xwrite(notify_.fds[1], buf, 1);
+        break;
+    case Notify::Type::EVENTFD:
+#if defined(HAVE_EVENTFD)
+        ret = xwrite(notify_.fds[0], sizeof(buf));
+#else
+        assert(0 && "eventfd not supported");
+        ret = -1;
+#endif
+    }
+
+    if (ret <= 0) {
+        return false;
+    }
+    return true;
+}
+
+void NotifyingEventBase::receiveNotifications() {
+    // Consume one event from the notification queue. There may be more,
+    // but the event is level-triggered and we'll wake up again and
+    // consume them.
+    bool consumed = consumeNotification();
+    if (!consumed) {
+        // XXX log?
+        return;
+    }
+
+    runOpsInQueue();
+
+    // The demultiplexer may block again without returning to the loop
+    beginWait();
+
+    notified();
+}
+
+void NotifyingEventBase::beginWait() {
+    for (;;) {
+        wakeState_.store(WakeState::SLEEPING, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (queueEmpty()) {
+            return;
+        }
+        // Enqueued by producers that saw the loop awake
+        runOpsInQueue();
+    }
+}
+
+size_t NotifyingEventBase::runOpsInQueue() {
+    wakeState_.store(WakeState::AWAKE, std::memory_order_relaxed);
+
+    // Execute all available messages
+    size_t count = 0;
+    for (;; ++count) {
+        auto op = notify_.ring ? notify_.ring->pop() : notify_.queue.pop();
+        if (!op) {
+            // Empty
+            break;
+        }
+        op.value()();
+    }
+    return count;
+}
+
+void NotifyingEventBase::spin() {
+    typedef std::chrono::steady_clock Clock;
+
+    // The clock is only consulted while idle
+    bool idle = false;
+    Clock::time_point idleSince;
+
+    while (!terminating()) {
+        if (runOpsInQueue() + poll() > 0) {
+            idle = false;
+            continue;
+        }
+
+        if (spinIdle_.count() == 0) {
+            continue;
+        }
+
+        auto now = Clock::now();
+        if (!idle) {
+            idle = true;
+            idleSince = now;
+        } else if (now - idleSince >= spinIdle_) {
+            wait();
+            idle = false;
+        }
+    }
+}
+
+void NotifyingEventBase::stop() {
+    auto terminate = [this]() -> void {
+        terminate_.store(true, std::memory_order_release);
+        breakLoop();
+    };
+    while (!runOnEventLoop(terminate, /*defer=*/ false)) {
+        // A bounded queue is full; the loop will drain it
+        std::this_thread::yield();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(await_.mutex);
+        await_.cv.wait(lock, [this]() { return await_.finished; });
+    }
+}
+
+} // wte namespace
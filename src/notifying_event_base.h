@@ -0,0 +1,214 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_NOTIFYING_EVENT_BASE_H_
+#define SRC_NOTIFYING_EVENT_BASE_H_
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "mpsc_queue.h"
+#include "wte/event_base.h"
+#include "wte/event_handler.h"
+#include "wte/porting.h"
+#include "wte/task.h"
+#include "write_request.h"
+
+namespace wte {
+
+/**
+ * Cross-thread plumbing shared by the event base implementations.
+ *
+ * Owns the operation queue and notification descriptors that back
+ * `runOnEventLoop`, tracks the loop-driving thread, and implements `stop`.
+ * The queue is unbounded unless `EventBaseOptions::notifyQueueCapacity` is
+ * set, in which case posts fail while it is full.
+ * Subclasses register `notifyHandler()` with their demultiplexer, bracket
+ * their loop with `beginLoop` / `endLoop`, and drain the queue with
+ * `runOpsInQueue` before blocking.
+ */
+class NotifyingEventBase : public EventBase {
+    struct NotifyInit;
+public:
+    ~NotifyingEventBase();
+
+    using EventBase::runOnEventLoop;
+    using EventBase::runOnEventLoopAndWait;
+
+    void stop() override;
+    bool runOnEventLoop(Task && op, bool defer) override;
+    bool runOnEventLoopAndWait(Task && op, bool defer) override;
+
+    /** @return the pool of write requests for streams on this base. */
+    WriteRequestPool* writeRequestPool() { return &writeRequests_; }
+
+    class NotifyHandler final : public EventHandler {
+    public:
+        NotifyHandler(NotifyingEventBase *base, int fd)
+                : EventHandler(fd), base_(base) { }
+        void ready(What event) NOEXCEPT {
+            switch (event) {
+            case What::READ:
+                base_->receiveNotifications();
+                break;
+            default:
+                // XXX log?
+                break;
+            }
+        }
+    private:
+        NotifyingEventBase *base_;
+    };
+
+    struct Notify {
+        enum class Type { PIPE, SOCKETPAIR, EVENTFD };
+        Type type;
+        ConcurrentMPSCQueue<Task> queue;
+        // Replaces `queue` if the base was configured with a capacity
+        std::unique_ptr<BoundedMPSCQueue<Task>> ring;
+        // Listen on 0, write on 1 (except eventfd, which is both on 1)
+        int fds[2];
+        NotifyHandler handler;
+        Notify(NotifyingEventBase *base, NotifyInit const&,
+            size_t capacity);
+    };
+protected:
+    explicit NotifyingEventBase(EventBaseOptions const& options);
+
+    /** Record the calling thread as the loop thread. */
+    void beginLoop();
+
+    /** Reset loop state and wake any `stop` waiters. */
+    void endLoop();
+
+    /** @return whether `stop` has been requested. */
+    bool terminating() {
+        return terminate_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Execute all operations currently in the notification queue.
+     *
+     * @return the number of operations executed
+     */
+    size_t runOpsInQueue();
+
+    /**
+     * Drive the loop in `LoopMode::SPIN` until stopped.
+     *
+     * Alternates between draining the queue and `poll`, falling back to
+     * `wait` once the configured idle period elapses without any work.
+     */
+    void spin();
+
+    /**
+     * Dispatch ready handlers and expired timeouts without blocking.
+     *
+     * @return the number of callbacks dispatched
+     */
+    virtual size_t poll() = 0;
+
+    /** Block until at least one event is dispatched or the loop breaks. */
+    virtual void wait() = 0;
+
+    /**
+     * Invoked on the loop thread after operations are run in response to
+     * a notification.
+     */
+    virtual void notified() { }
+
+    /**
+     * Publish that the loop thread is about to block.
+     *
+     * Until then, producers skip the notification write, relying on the
+     * loop to drain the queue before it blocks. Runs any operations that
+     * were enqueued without a notification. Must be invoked immediately
+     * before every blocking wait on the demultiplexer.
+     */
+    void beginWait();
+
+    /** Publish that the loop thread has returned from a blocking wait. */
+    void endWait() {
+        wakeState_.store(WakeState::AWAKE, std::memory_order_relaxed);
+    }
+
+    // In the loop thread or loop is not running
+    bool inLoopThread();
+
+    /** @return the handler for the notification descriptor. */
+    EventHandler* notifyHandler() { return &notify_.handler; }
+
+    /**
+     * Wake the demultiplexer so that the current loop iteration returns.
+     *
+     * Invoked on the loop thread after the termination flag is set.
+     */
+    virtual void breakLoop() = 0;
+private:
+    static NotifyInit initNotify();
+    void receiveNotifications();
+    bool consumeNotification();
+    bool signalNotifyQueue();
+
+    enum class WakeState {
+        // Will drain the queue before blocking; no notification needed
+        AWAKE,
+        // Blocked, or about to block
+        SLEEPING,
+        // A notification was sent since the loop last slept
+        NOTIFIED,
+    };
+
+    bool queueEmpty() const {
+        return notify_.ring ? notify_.ring->empty() : notify_.queue.empty();
+    }
+
+    std::atomic<bool> terminate_;
+    std::atomic<WakeState> wakeState_;
+    const std::chrono::microseconds spinIdle_;
+#if !defined(_WIN32)
+    std::atomic<pthread_t> loopThread_;
+#else
+    std::atomic<HANDLE> loopThread_;
+#endif
+
+    struct {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool finished = false;
+    } await_;
+
+    struct Notify notify_;
+
+    WriteRequestPool writeRequests_;
+};
+
+} // wte namespace
+
+#endif // SRC_NOTIFYING_EVENT_BASE_H_
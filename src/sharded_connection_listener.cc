@@ -0,0 +1,190 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#endif
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libevent_connection_listener.h"
+#include "wte/connection_listener.h"
+#include "wte/event_base_pool.h"
+
+namespace wte {
+
+class ShardedConnectionListener final : public ConnectionListener {
+public:
+    ShardedConnectionListener(std::shared_ptr<EventBasePool> pool,
+        std::function<void(std::shared_ptr<EventBase>, int)> const&
+            acceptCallback,
+        std::function<void(std::exception const&)> errorCallback,
+        ShardedListenerOptions const& options);
+    ~ShardedConnectionListener();
+
+    void bind(uint16_t port) override;
+    void bind(std::string const& ip_addr, uint16_t port) override;
+    void listen(int backlog) override;
+    void startAccepting() override;
+    void stopAccepting() override;
+    uint16_t port() override { return shards_[0]->port(); }
+    void setAcceptBatchLimit(size_t limit) override;
+private:
+    void steerByCpu();
+
+    // Invoke `op` on each shard, on that shard's loop
+    void forEachShard(
+        std::function<void(LibeventConnectionListener*)> const& op);
+
+    std::shared_ptr<EventBasePool> pool_;
+    std::vector<std::unique_ptr<LibeventConnectionListener>> shards_;
+    bool steerByCpu_;
+};
+
+ShardedConnectionListener::ShardedConnectionListener(
+        std::shared_ptr<EventBasePool> pool,
+        std::function<void(std::shared_ptr<EventBase>, int)> const&
+            acceptCallback,
+        std::function<void(std::exception const&)> errorCallback,
+        ShardedListenerOptions const& options)
+    : pool_(pool), steerByCpu_(options.steerByCpu) {
+#if !defined(SO_REUSEPORT)
+    throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+#if !defined(SO_ATTACH_REUSEPORT_CBPF)
+    if (steerByCpu_) {
+        throw std::runtime_error(
+            "CPU steering is not supported on this platform");
+    }
+#endif
+    for (size_t i = 0; i < pool_->size(); ++i) {
+        auto base = pool_->get(i);
+        std::unique_ptr<LibeventConnectionListener> shard(
+            new LibeventConnectionListener(base,
+                [acceptCallback, base](int fd) { acceptCallback(base, fd); },
+                errorCallback));
+        shard->setReusePort(true);
+        shards_.push_back(std::move(shard));
+    }
+}
+
+ShardedConnectionListener::~ShardedConnectionListener() {
+    // Shards unregister their handlers on destruction
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        pool_->get(i)->runOnEventLoopAndWait([this, i]() {
+                shards_[i].reset();
+            }, /*defer=*/ false);
+    }
+}
+
+void ShardedConnectionListener::forEachShard(
+        std::function<void(LibeventConnectionListener*)> const& op) {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        LibeventConnectionListener *shard = shards_[i].get();
+        pool_->get(i)->runOnEventLoopAndWait([&op, shard]() { op(shard); },
+            /*defer=*/ false);
+    }
+}
+
+void ShardedConnectionListener::bind(uint16_t port) {
+    bind("0.0.0.0", port);
+}
+
+void ShardedConnectionListener::bind(std::string const& ip_addr,
+        uint16_t port) {
+    // The first shard resolves an ephemeral port for the rest. Sockets join
+    // the SO_REUSEPORT group in shard order, which the steering program
+    // relies on.
+    for (auto& shard : shards_) {
+        shard->bind(ip_addr, port);
+        port = shard->port();
+    }
+
+    if (steerByCpu_) {
+        steerByCpu();
+    }
+}
+
+void ShardedConnectionListener::steerByCpu() {
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+    // return cpu % shards; the kernel falls back to hashing if the selected
+    // socket is gone
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0,
+            static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0,
+            static_cast<uint32_t>(shards_.size()) },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    // The program applies to the whole group
+    if (-1 == setsockopt(shards_[0]->fd(), SOL_SOCKET,
+            SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+        throw std::runtime_error("Failed to attach steering program");
+    }
+#endif
+}
+
+void ShardedConnectionListener::listen(int backlog) {
+    for (auto& shard : shards_) {
+        shard->listen(backlog);
+    }
+}
+
+void ShardedConnectionListener::startAccepting() {
+    forEachShard([](LibeventConnectionListener *shard) {
+            shard->startAccepting();
+        });
+}
+
+void ShardedConnectionListener::stopAccepting() {
+    forEachShard([](LibeventConnectionListener *shard) {
+            shard->stopAccepting();
+        });
+}
+
+void ShardedConnectionListener::setAcceptBatchLimit(size_t limit) {
+    forEachShard([limit](LibeventConnectionListener *shard) {
+            shard->setAcceptBatchLimit(limit);
+        });
+}
+
+std::shared_ptr<ConnectionListener> mkShardedConnectionListener(
+        std::shared_ptr<EventBasePool> pool,
+        std::function<void(std::shared_ptr<EventBase>, int)> const&
+            acceptCallback,
+        std::function<void(std::exception const&)> errorCallback,
+        ShardedListenerOptions const& options) {
+    return std::shared_ptr<ConnectionListener>(
+        new ShardedConnectionListener(pool, acceptCallback, errorCallback,
+            options),
+        std::default_delete<ConnectionListener>());
+}
+
+} // wte namespace
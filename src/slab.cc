@@ -0,0 +1,117 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "slab.h"
+
+#include <new>
+
+namespace wte {
+
+namespace {
+
+const size_t kClassSizes[] = { 64, 512, 4096, 16384, 65536 };
+const size_t kClasses = sizeof(kClassSizes) / sizeof(kClassSizes[0]);
+
+// Bytes each thread may cache per size class
+const size_t kMaxCachedBytes = 256 * 1024;
+const size_t kMaxCachedBlocks = 256;
+
+// Index of the smallest class holding `size` bytes, or kClasses
+inline size_t sizeClass(size_t size) {
+    size_t i = 0;
+    while (i < kClasses && kClassSizes[i] < size) {
+        ++i;
+    }
+    return i;
+}
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+// Trivially destructible, so that it remains usable while other
+// thread-local objects are destroyed
+struct Cache {
+    FreeBlock *free[kClasses];
+    size_t count[kClasses];
+    bool finished;
+};
+
+thread_local Cache tCache;
+
+// Returns cached blocks to the system allocator on thread exit
+struct CacheReaper {
+    ~CacheReaper() {
+        for (size_t i = 0; i < kClasses; ++i) {
+            while (tCache.free[i]) {
+                FreeBlock *block = tCache.free[i];
+                tCache.free[i] = block->next;
+                ::operator delete(block);
+            }
+            tCache.count[i] = 0;
+        }
+        tCache.finished = true;
+    }
+};
+
+thread_local CacheReaper tReaper;
+
+} // unnamed namespace
+
+size_t Slab::roundUp(size_t size) {
+    size_t i = sizeClass(size);
+    return i < kClasses ? kClassSizes[i] : size;
+}
+
+void* Slab::allocate(size_t size) {
+    size_t i = sizeClass(size);
+    if (i == kClasses) {
+        return ::operator new(size);
+    }
+
+    FreeBlock *block = tCache.free[i];
+    if (block) {
+        tCache.free[i] = block->next;
+        --tCache.count[i];
+        return block;
+    }
+
+    return ::operator new(kClassSizes[i]);
+}
+
+void Slab::deallocate(void *ptr, size_t size) {
+    size_t i = sizeClass(size);
+    if (i == kClasses || tCache.finished
+            || tCache.count[i] >= kMaxCachedBlocks
+            || tCache.count[i] * kClassSizes[i] >= kMaxCachedBytes) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    // Ensure that the cache is flushed when this thread exits
+    (void) &tReaper;
+
+    FreeBlock *block = static_cast<FreeBlock*>(ptr);
+    block->next = tCache.free[i];
+    tCache.free[i] = block;
+    ++tCache.count[i];
+}
+
+} // wte namespace
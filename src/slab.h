@@ -0,0 +1,50 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_SLAB_H_
+#define SRC_SLAB_H_
+
+#include <cstddef>
+
+namespace wte {
+
+/**
+ * Size-classed allocator with per-thread caches.
+ *
+ * Requests are rounded up to a size class (64 bytes through 64 KiB); freed
+ * blocks are kept on a bounded freelist of the freeing thread and handed
+ * out again without touching the system allocator. Larger requests are
+ * passed through to `operator new`. Blocks may be freed on any thread.
+ */
+class Slab {
+public:
+    /** @return the size of the block that would satisfy `size` bytes. */
+    static size_t roundUp(size_t size);
+
+    /** Allocate a block of `roundUp(size)` bytes. */
+    static void* allocate(size_t size);
+
+    /** Free a block obtained from `allocate(size)`. */
+    static void deallocate(void *ptr, size_t size);
+};
+
+} // wte namespace
+
+#endif // SRC_SLAB_H_
@@ -33,16 +33,30 @@
 #include <ws2tcpip.h>
 #endif
 
+#if defined(HAVE_IO_URING)
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#endif
+
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <limits>
 
 #include <event2/util.h>
 
 #include "buffer-internal.h"
+#if defined(HAVE_IO_URING)
+#include "io_uring_event_base.h"
+#endif
+#include "notifying_event_base.h"
 #include "wte/buffer.h"
 #include "wte/event_base.h"
 #include "wte/event_handler.h"
 #include "wte/porting.h"
+#include "wte/timeout.h"
+#include "write_request.h"
 #include "xplat-io.h"
 
 namespace wte {
@@ -55,6 +69,17 @@ inline bool isConnectRetryable(int e) {
 #endif
 }
 
+// Bounds for the adaptive read size
+const size_t kMinReadSize = 4096;
+const size_t kMaxReadSize = 256 * 1024;
+
+// Upper bound on the bytes gathered into a single writev
+const size_t kMaxWriteSize = 1024 * 1024;
+
+// Interval at which zero-copy completions are polled while read interest
+// is withheld, in microseconds
+const long kCompletionPollMicros = 1000;
+
 inline bool isReadRetryable(int e) {
 #if !defined(_WIN32)
     return e == EAGAIN || e == EWOULDBLOCK;
@@ -63,31 +88,202 @@ inline bool isReadRetryable(int e) {
 #endif
 }
 
+inline bool isWriteRetryable(int e) {
+    return isReadRetryable(e);
+}
+
+#if defined(HAVE_SENDFILE)
+/**
+ * Send as much of `range` as the socket accepts, advancing the range.
+ *
+ * @param sent incremented by the bytes sent
+ * @return false on error, or if the file ends before the range
+ */
+bool sendRange(int fd, WriteRequest::FileRange *range, size_t *sent) {
+    while (range->size > 0) {
+        ssize_t rc = xsendfile(fd, range->fd, &range->offset,
+            std::min(range->size, kMaxWriteSize));
+        if (rc < 0) {
+            return isWriteRetryable(evutil_socket_geterror(fd));
+        } else if (rc == 0) {
+            return false;
+        }
+        range->size -= rc;
+        *sent += rc;
+    }
+    return true;
+}
+#endif
+
+// Event bases built on NotifyingEventBase share a pool among their streams
+WriteRequestPool* writeRequestPool(EventBase *base,
+        std::unique_ptr<WriteRequestPool> *fallback) {
+    auto *notifying = dynamic_cast<NotifyingEventBase*>(base);
+    if (notifying) {
+        return notifying->writeRequestPool();
+    }
+    fallback->reset(new WriteRequestPool());
+    return fallback->get();
+}
+
 class StreamImpl final : public Stream {
 public:
     // TODO: temporary fd-based constructor for testing
     StreamImpl(std::shared_ptr<EventBase> base, int fd) : handler_(this, fd),
-        base_(base), requests_({nullptr, nullptr}), readCallback_(nullptr),
-        connectCallback_(nullptr) { }
+        base_(base), requests_({nullptr, nullptr, writeRequestPool(base.get(),
+            &ownPool_)}), readCallback_(nullptr),
+        connectCallback_(nullptr), readSize_(kMinReadSize) {
+        pinned_.pool = requests_.pool;
+    }
 
     explicit StreamImpl(std::shared_ptr<EventBase> base) : handler_(this, -1),
-        base_(base), requests_({nullptr, nullptr}), readCallback_(nullptr),
-        connectCallback_(nullptr) { }
+        base_(base), requests_({nullptr, nullptr, writeRequestPool(base.get(),
+            &ownPool_)}), readCallback_(nullptr),
+        connectCallback_(nullptr), readSize_(kMinReadSize) {
+        pinned_.pool = requests_.pool;
+    }
 
     ~StreamImpl();
 
     void write(const char *buf, size_t size, WriteCallback *cb) override;
     void write(Buffer *buf, WriteCallback *cb) override;
+    void sendFile(int fd, off_t offset, size_t size, WriteCallback *cb)
+        override;
     void startRead(ReadCallback *cb) override;
+    void setReadFraming(ReadFraming const& framing) override;
     void stopRead() override;
     void close() override;
+    void setWriteCompletion(WriteCompletion completion) override {
+        writeCompletion_ = completion;
+    }
+    size_t pendingWriteBytes() const override { return pendingBytes_; }
+    void setWriteWatermarks(size_t low, size_t high, WatermarkCallback *cb)
+        override;
+    void setMaxPendingWriteBytes(size_t max) override {
+        maxPendingBytes_ = max;
+    }
+    void setZeroCopyThreshold(size_t size) override {
+        zeroCopyThreshold_ = size;
+    }
     void connect(std::string const& ip_addr, int16_t port, ConnectCallback *cb)
         override;
 private:
     void writeHelper();
+
+    /** @return whether `req` should be sent with MSG_ZEROCOPY. */
+    bool wantsZeroCopy(WriteRequest const *req) const;
+
+    /**
+     * Send the request at the head of the queue with MSG_ZEROCOPY, pinning
+     * the sent data until the kernel releases it.
+     *
+     * @return whether it completed with further requests queued
+     */
+    bool sendZeroCopy();
+
+    /**
+     * Read zero-copy completions, invoking the callbacks of released sends
+     * and of the writes ordered behind them.
+     *
+     * @return false if a callback destroyed the stream
+     */
+    bool releaseZeroCopy();
+
+    /**
+     * Arrange to be notified of zero-copy completions: through read
+     * interest, or by polling while input is left unread.
+     */
+    void watchCompletions();
+
+    /**
+     * Leave input in the socket until a read callback is installed. Read
+     * interest would report it on every iteration of a level-triggered
+     * base, so completions are polled instead while it waits.
+     */
+    void leaveInputUnread();
+
+    /**
+     * Invoke the callback of a written request, unless it must wait behind
+     * zero-copy sends that are still in flight.
+     */
+    void completeWrite(WriteCallback *cb);
+
+    /**
+     * Send the file-backed request at the head of the queue.
+     *
+     * @return whether it completed with further requests queued
+     */
+    bool sendFileHelper();
+
+    /** @return a request for `cb`, drawn from the base's pool. */
+    WriteRequest* newRequest(WriteCallback *cb);
+
+    /** @return whether a write may be attempted before queueing it. */
+    bool canWriteInline();
+
+    /** Queue a write until the descriptor is writable. */
+    void queueWrite(WriteRequest *req);
+
+    /** Start writing queued requests. */
+    void armWrite();
+
+    /** @return false after failing a write that exceeds the queue limit. */
+    bool admitWrite(size_t size, WriteCallback *cb);
+
+    /**
+     * Account for queued data written to the descriptor.
+     *
+     * @return false if a watermark callback destroyed the stream
+     */
+    bool writeDrained(size_t count);
+
+    /** Deliver or schedule the completion of a write that went out inline. */
+    void writeCompleted(WriteCallback *cb);
+
+    /**
+     * Invoke the deferred completions of inline writes.
+     *
+     * @return false if a callback destroyed the stream
+     */
+    bool flushCompletions();
     void readHelper();
+
+    enum class FrameStatus { INCOMPLETE, READY, TOO_LARGE };
+
+    /**
+     * Locate the next frame in the read buffer.
+     *
+     * @param skip set to the bytes preceding the frame (its length prefix)
+     * @param size set to the frame size
+     */
+    FrameStatus nextFrame(size_t *skip, size_t *size);
+
+    /**
+     * Pass buffered data to the read callback, a frame at a time if framing
+     * is configured.
+     *
+     * @return false if a callback destroyed the stream
+     */
+    bool deliver();
     void connectHelper();
 
+#if defined(HAVE_IO_URING)
+    // Completion-based I/O, used in place of `handler_` on io_uring bases
+    class UringOp;
+    class RecvOp;
+    class SendOp;
+    class ConnectOp;
+
+    void submitRecv();
+    void submitSend();
+    void recvComplete(int result);
+    void sendComplete(int result);
+    void connectComplete(int result);
+
+    // Detach in-flight operations from this stream, cancelling them
+    void orphanOps();
+#endif
+
     class SockHandler final : public EventHandler {
     public:
         SockHandler(StreamImpl *stream, int fd)
@@ -97,22 +293,22 @@ private:
         StreamImpl *stream_;
     };
 
-    // State about a write request (buffer, callback)
-    class WriteRequest {
+    class CompletionTimeout final : public Timeout {
     public:
-        WriteRequest(const char *buffer, size_t size, WriteCallback *cb);
-        WriteRequest(Buffer *buf, WriteCallback *cb);
-        ~WriteRequest();
-        BufferImpl buffer_;
-        WriteCallback *callback_;
-        WriteRequest *next_;
+        explicit CompletionTimeout(StreamImpl *stream) : stream_(stream) { }
+        void expired() NOEXCEPT override;
+    private:
+        StreamImpl *stream_;
     };
 
     SockHandler handler_;
     std::shared_ptr<EventBase> base_;
+    // Used when the base does not provide a pool
+    std::unique_ptr<WriteRequestPool> ownPool_;
     struct Requests {
         WriteRequest *head;
         WriteRequest *tail;
+        WriteRequestPool *pool;
 
         void append(WriteRequest *req) {
             if (!head) {
@@ -121,6 +317,7 @@ private:
                 tail = req;
             } else {
                 tail->next_ = req;
+                tail = req;
             }
         }
 
@@ -133,16 +330,128 @@ private:
             if (!head) {
                 tail = nullptr;
             }
-            delete tmp;
+            pool->put(tmp);
             return head;
         }
     } requests_;
     ReadCallback *readCallback_;
     ConnectCallback *connectCallback_;
     BufferImpl readBuffer_;
+    ReadFraming framing_;
+    // Holds each frame while it is delivered
+    BufferImpl frame_;
+    // Prefix of the read buffer already searched for the delimiter
+    size_t scanned_ = 0;
+    // Space reserved per read, adapted to the size of recent bursts
+    size_t readSize_;
+    std::vector<Extent> readExtents_;
+    // Extents gathered across queued requests for the next write
+    std::vector<Extent> writeExtents_;
+    WriteCompletion writeCompletion_ = WriteCompletion::DEFERRED;
+    // Bytes held by queued requests
+    size_t pendingBytes_ = 0;
+    size_t maxPendingBytes_ = 0;
+    size_t lowWatermark_ = 0;
+    size_t highWatermark_ = 0;
+    // Whether `full` fired since pending bytes were last below low
+    bool aboveWatermark_ = false;
+    WatermarkCallback *watermarkCallback_ = nullptr;
+    // Callbacks of inline writes awaiting deferred completion, in order
+    std::vector<WriteCallback*> completed_;
+    // Writes of at least this size are sent with MSG_ZEROCOPY, if nonzero
+    size_t zeroCopyThreshold_ = 0;
+    // Whether SO_ZEROCOPY has been enabled on the descriptor
+    bool zeroCopyEnabled_ = false;
+    // Sequence number of the next zero-copy send
+    uint32_t zeroCopySeq_ = 0;
+    // Zero-copy sends awaiting release by the kernel, interleaved with the
+    // callbacks of the writes that completed after them
+    Requests pinned_ = { nullptr, nullptr, nullptr };
+    // Whether input is left unread without a read callback; read interest
+    // would then spin on level-triggered bases, so completions are polled
+    bool inputWaiting_ = false;
+    CompletionTimeout completionTimeout_{this};
+    // Observed by deferred completions to detect a destroyed stream
+    std::shared_ptr<StreamImpl*> token_ = std::make_shared<StreamImpl*>(this);
+#if defined(HAVE_IO_URING)
+    IoUringEventBase *uring_ = dynamic_cast<IoUringEventBase*>(base_.get());
+    RecvOp *recv_ = nullptr;
+    SendOp *send_ = nullptr;
+    ConnectOp *connect_ = nullptr;
+#endif
+};
+
+#if defined(HAVE_IO_URING)
+class StreamImpl::UringOp : public IoRequest {
+public:
+    explicit UringOp(StreamImpl *stream) : stream_(stream), pending_(false) { }
+
+    // Null once the stream has been closed or destroyed; the operation then
+    // releases itself on completion
+    StreamImpl *stream_;
+    bool pending_;
 };
 
+class StreamImpl::RecvOp final : public UringOp {
+public:
+    explicit RecvOp(StreamImpl *stream) : UringOp(stream) { }
+
+    void complete(int result) NOEXCEPT override {
+        pending_ = false;
+        if (!stream_) {
+            delete this;
+            return;
+        }
+        stream_->recvComplete(result);
+    }
+
+    char buf_[16384];
+};
+
+class StreamImpl::SendOp final : public UringOp {
+public:
+    explicit SendOp(StreamImpl *stream) : UringOp(stream) { }
+
+    void complete(int result) NOEXCEPT override {
+        pending_ = false;
+        if (!stream_) {
+            delete this;
+            return;
+        }
+        stream_->sendComplete(result);
+    }
+
+    std::vector<struct iovec> iov_;
+    std::vector<Extent> extents_;
+    struct msghdr msg_;
+    // Data referenced by `iov_` whose stream went away mid-send
+    BufferImpl keep_;
+};
+
+class StreamImpl::ConnectOp final : public UringOp {
+public:
+    explicit ConnectOp(StreamImpl *stream) : UringOp(stream) { }
+
+    void complete(int result) NOEXCEPT override {
+        pending_ = false;
+        if (!stream_) {
+            delete this;
+            return;
+        }
+        stream_->connectComplete(result);
+    }
+
+    struct sockaddr_in addr_;
+};
+#endif
+
 void StreamImpl::SockHandler::ready(What event) NOEXCEPT {
+    // Zero-copy completions are signalled as errors, which are reported
+    // to whichever events are watched
+    if (stream_->pinned_.head && !stream_->releaseZeroCopy()) {
+        return;
+    }
+
     if (isWrite(event)) {
         if (stream_->connectCallback_) {
             stream_->connectHelper();
@@ -150,29 +459,80 @@ void StreamImpl::SockHandler::ready(What event) NOEXCEPT {
         stream_->writeHelper();
     }
 
-   if (isRead(event)) {
-       stream_->readHelper();
-   }
+    if (isRead(event)) {
+        if (stream_->readCallback_) {
+            stream_->readHelper();
+        } else if (stream_->pinned_.head) {
+            // Read interest is held only for the completions
+            stream_->leaveInputUnread();
+        }
+    }
 }
 
-StreamImpl::WriteRequest::WriteRequest(const char *buffer, size_t size,
-        WriteCallback *cb) : callback_(cb), next_(nullptr) {
-    buffer_.append(buffer, size);
+void StreamImpl::CompletionTimeout::expired() NOEXCEPT {
+    if (!stream_->pinned_.head || !stream_->releaseZeroCopy()) {
+        return;
+    }
+    if (stream_->pinned_.head) {
+        stream_->watchCompletions();
+    }
 }
 
-StreamImpl::WriteRequest::WriteRequest(Buffer *buffer, WriteCallback *cb)
-        : callback_(cb), next_(nullptr) {
-    buffer_.append(buffer);
+WriteRequest* StreamImpl::newRequest(WriteCallback *cb) {
+    WriteRequest *req = requests_.pool->get();
+    req->callback_ = cb;
+    return req;
 }
 
-StreamImpl::WriteRequest::~WriteRequest() { }
-
 void StreamImpl::startRead(Stream::ReadCallback *cb) {
     if (readCallback_ == cb) {
         return;
     }
     readCallback_ = cb;
-    base_->registerHandler(&handler_, ensureRead(handler_.watched()));
+#if defined(HAVE_IO_URING)
+    if (uring_) {
+        submitRecv();
+        return;
+    }
+#endif
+    if (inputWaiting_) {
+        // Read interest observes completions again
+        inputWaiting_ = false;
+        base_->unregisterTimeout(&completionTimeout_);
+    }
+    What events = handler_.watched();
+    if (isRead(events) && base_->edgeTriggered()) {
+        // Read interest was held for zero-copy completions, so input may
+        // have arrived unread. Re-adding the descriptor re-evaluates its
+        // readiness.
+        base_->registerHandler(&handler_, What::NONE);
+    }
+    base_->registerHandler(&handler_, ensureRead(events));
+}
+
+void StreamImpl::setReadFraming(ReadFraming const& framing) {
+    switch (framing.mode) {
+    case ReadFraming::Mode::FIXED:
+        if (framing.size == 0) {
+            throw std::runtime_error("Fixed frames must be nonempty");
+        }
+        break;
+    case ReadFraming::Mode::LENGTH_PREFIXED:
+        switch (framing.prefixWidth) {
+        case 1:
+        case 2:
+        case 4:
+        case 8:
+            break;
+        default:
+            throw std::runtime_error("Unsupported length prefix width");
+        }
+        break;
+    default:
+        break;
+    }
+    framing_ = framing;
+    scanned_ = 0;
 }
 
 void StreamImpl::stopRead() {
@@ -182,30 +542,243 @@ void StreamImpl::stopRead() {
 
     readCallback_ = nullptr;
 
-    What events = handler_.watched();
-    if (!isRead(handler_.watched())) {
+    // An outstanding completion-based receive is left in place; its data
+    // are retained in the read buffer
+
+    if (pinned_.head) {
+        // Zero-copy completions are signalled as readable; read interest
+        // is dropped by `releaseZeroCopy` once they are all released
         return;
-    } else if (isWrite(handler_.watched())) {
-        assert(events == What::READ_WRITE);
-        base_->registerHandler(&handler_, What::WRITE);
+    }
+    if (isRead(handler_.watched())) {
+        base_->registerHandler(&handler_, removeRead(handler_.watched()));
     }
 }
 
 void StreamImpl::write(const char *buf, size_t size, WriteCallback *cb) {
-    // TODO: try writing immediately, saving a loop iteration if the socket
-    // can handle the entire write w/o blocking
-    WriteRequest *req = new WriteRequest(buf, size, cb);
-    requests_.append(req);
-    base_->registerHandler(&handler_, ensureWrite(handler_.watched()));
+    if (!admitWrite(size, cb)) {
+        return;
+    }
+    if (canWriteInline()) {
+        int written = xwrite(handler_.fd(), buf, size);
+        if (written >= 0 && static_cast<size_t>(written) == size) {
+            writeCompleted(cb);
+            return;
+        }
+        if (written > 0) {
+            // Queue only the remainder
+            buf += written;
+            size -= written;
+        }
+    }
+    WriteRequest *req = newRequest(cb);
+    req->buffer_.append(buf, size);
+    queueWrite(req);
 }
 
 void StreamImpl::write(Buffer *buf, WriteCallback *cb) {
-    WriteRequest *req = new WriteRequest(buf, cb);
+    if (!admitWrite(buf->size(), cb)) {
+        return;
+    }
+    // Zero-copy sends are made from the queue, which keeps them pinned
+    bool zeroCopy = zeroCopyThreshold_ != 0
+        && buf->size() >= zeroCopyThreshold_;
+    if (canWriteInline() && !zeroCopy) {
+        writeExtents_.clear();
+        buf->peek(kMaxWriteSize, &writeExtents_);
+        int written = 0;
+        if (!writeExtents_.empty()) {
+            written = xwritev(handler_.fd(), writeExtents_.data(),
+                writeExtents_.size());
+        }
+        if (written > 0) {
+            buf->drain(written);
+        }
+        if (written >= 0 && buf->empty()) {
+            writeCompleted(cb);
+            return;
+        }
+    }
+    WriteRequest *req = newRequest(cb);
+    req->buffer_.append(buf);
+    queueWrite(req);
+}
+
+void StreamImpl::sendFile(int fd, off_t offset, size_t size,
+        WriteCallback *cb) {
+#if defined(HAVE_SENDFILE)
+#if defined(HAVE_IO_URING)
+    const bool useSendfile = !uring_;
+#else
+    const bool useSendfile = true;
+#endif
+    if (useSendfile) {
+        // Mapped regions are checked by `appendFile`
+        if (!xfileHasRange(fd, offset, size)) {
+            if (cb) {
+                cb->error(std::runtime_error(
+                    "Region extends beyond the end of the file"));
+            }
+            return;
+        }
+        if (!admitWrite(size, cb)) {
+            return;
+        }
+        WriteRequest::FileRange range;
+        range.fd = fd;
+        range.offset = offset;
+        range.size = size;
+        if (canWriteInline()) {
+            size_t sent = 0;
+            if (!sendRange(handler_.fd(), &range, &sent)) {
+                if (cb) {
+                    cb->error(std::runtime_error("Write failed"));
+                }
+                return;
+            }
+            if (range.size == 0) {
+                writeCompleted(cb);
+                return;
+            }
+        }
+        WriteRequest *req = newRequest(cb);
+        req->file_ = range;
+        queueWrite(req);
+        return;
+    }
+#endif
+    // Completion-based bases and platforms without sendfile map the file
+    BufferImpl mapped;
+    try {
+        mapped.appendFile(fd, offset, size);
+    } catch (std::runtime_error const& e) {
+        if (cb) {
+            cb->error(e);
+        }
+        return;
+    }
+    write(&mapped, cb);
+}
+
+bool StreamImpl::canWriteInline() {
+#if defined(HAVE_IO_URING)
+    if (uring_) {
+        return false;
+    }
+#endif
+    // Writes must not overtake queued requests, nor complete before
+    // zero-copy sends
+    return !requests_.head && !pinned_.head && !connectCallback_
+        && handler_.fd() != -1;
+}
+
+void StreamImpl::setWriteWatermarks(size_t low, size_t high,
+        WatermarkCallback *cb) {
+    if (high != 0 && low > high) {
+        throw std::runtime_error("Low watermark exceeds high watermark");
+    }
+    lowWatermark_ = low;
+    highWatermark_ = high;
+    watermarkCallback_ = cb;
+    aboveWatermark_ = false;
+}
+
+bool StreamImpl::admitWrite(size_t size, WriteCallback *cb) {
+    if (maxPendingBytes_ == 0 || pendingBytes_ + size <= maxPendingBytes_) {
+        return true;
+    }
+    if (cb) {
+        cb->error(std::runtime_error("Write queue full"));
+    }
+    return false;
+}
+
+void StreamImpl::queueWrite(WriteRequest *req) {
     requests_.append(req);
+    pendingBytes_ += req->size();
+    armWrite();
+
+    if (highWatermark_ != 0 && !aboveWatermark_
+            && pendingBytes_ >= highWatermark_) {
+        aboveWatermark_ = true;
+        if (watermarkCallback_) {
+            watermarkCallback_->full(this);
+        }
+    }
+}
+
+void StreamImpl::armWrite() {
+#if defined(HAVE_IO_URING)
+    if (uring_) {
+        submitSend();
+        return;
+    }
+#endif
     base_->registerHandler(&handler_, ensureWrite(handler_.watched()));
 }
 
+bool StreamImpl::writeDrained(size_t count) {
+    pendingBytes_ -= count;
+    if (!aboveWatermark_ || pendingBytes_ > lowWatermark_) {
+        return true;
+    }
+    aboveWatermark_ = false;
+    if (!watermarkCallback_) {
+        return true;
+    }
+    std::weak_ptr<StreamImpl*> token = token_;
+    watermarkCallback_->writable(this);
+    return !token.expired();
+}
+
+void StreamImpl::writeCompleted(WriteCallback *cb) {
+    if (!cb) {
+        return;
+    }
+
+    if (writeCompletion_ == WriteCompletion::INLINE) {
+        // Earlier writes may still be awaiting deferred completion
+        if (completed_.empty() || flushCompletions()) {
+            cb->complete(this);
+        }
+        return;
+    }
+
+    completed_.push_back(cb);
+    if (completed_.size() > 1) {
+        // Already scheduled
+        return;
+    }
+
+    std::weak_ptr<StreamImpl*> token = token_;
+    bool scheduled = base_->runOnEventLoop([token]() -> void {
+            auto stream = token.lock();
+            if (stream) {
+                (*stream)->flushCompletions();
+            }
+        }, /*defer=*/ true);
+    if (!scheduled) {
+        // The loop's queue is full; complete via the write handler instead
+        completed_.pop_back();
+        queueWrite(newRequest(cb));
+    }
+}
+
+bool StreamImpl::flushCompletions() {
+    std::weak_ptr<StreamImpl*> token = token_;
+    // Callbacks may issue further inline writes, extending the list
+    for (size_t i = 0; i < completed_.size(); ++i) {
+        completed_[i]->complete(this);
+        if (token.expired()) {
+            return false;
+        }
+    }
+    completed_.clear();
+    return true;
+}
+
 void StreamImpl::close() {
+    completed_.clear();
     if (readCallback_) {
         readCallback_->eof();
     }
@@ -215,6 +788,12 @@ void StreamImpl::close() {
     if (handler_.registered()) {
         handler_.unregister();
     }
+    base_->unregisterTimeout(&completionTimeout_);
+#if defined(HAVE_IO_URING)
+    if (uring_) {
+        orphanOps();
+    }
+#endif
 
     if (handler_.fd() != -1) {
         xclose(handler_.fd());
@@ -251,6 +830,21 @@ void StreamImpl::connect(std::string const& ip, int16_t port,
         }
 
         saddr.sin_port = htons(port);
+#if defined(HAVE_IO_URING)
+        if (uring_) {
+            handler_.setFd(fd);
+            connectCallback_ = cb;
+            if (!connect_) {
+                connect_ = new ConnectOp(this);
+            }
+            connect_->addr_ = saddr;
+            connect_->pending_ = true;
+            uring_->submitConnect(connect_, fd,
+                reinterpret_cast<struct sockaddr*>(&connect_->addr_),
+                sizeof(connect_->addr_));
+            return;
+        }
+#endif
         socklen_t len = sizeof(saddr);
         rc = ::connect(fd, reinterpret_cast<struct sockaddr*>(&saddr), len);
         if (rc == -1) {
@@ -283,17 +877,34 @@ void StreamImpl::connect(std::string const& ip, int16_t port,
 
 StreamImpl::~StreamImpl() {
     handler_.unregister();
+    base_->unregisterTimeout(&completionTimeout_);
+#if defined(HAVE_IO_URING)
+    if (uring_) {
+        orphanOps();
+    }
+#endif
     WriteRequest *r;
     // Delete all outstanding write requests
     while ((r = requests_.consumeFront()) != nullptr) { }
+    while ((r = pinned_.consumeFront()) != nullptr) { }
 }
 
 void StreamImpl::readHelper() {
-    char buf[4096];
+    size_t burst = 0;
 
     // TODO: consider not reading indefinitely
     for (;;) {
-        int nread = xread(handler_.fd(), buf, sizeof(buf));
+        // Read directly into the buffer's free space. Drained buffers keep
+        // their last extent, so steady-state reads do not allocate.
+        readExtents_.clear();
+        readBuffer_.reserve(readSize_, &readExtents_);
+        size_t reserved = 0;
+        for (auto const& extent : readExtents_) {
+            reserved += extent.size;
+        }
+
+        int nread = xreadv(handler_.fd(), readExtents_.data(),
+            readExtents_.size());
         if (nread < 0) {
             if (isReadRetryable(evutil_socket_geterror(handler_.fd()))) {
                 break;
@@ -310,19 +921,121 @@ void StreamImpl::readHelper() {
             break;
         }
 
-        // TODO: a reserve + get readable iovec + readv will be more efficient
-        // than a read + append.
-        readBuffer_.append(buf, nread);
+        readBuffer_.commit(nread);
+        burst += nread;
 
-        if (readCallback_) {
-            readCallback_->available(&readBuffer_);
+        bool filled = static_cast<size_t>(nread) == reserved;
+        if (filled) {
+            // More is likely waiting; grow toward the burst size
+            readSize_ = std::min(readSize_ * 2, kMaxReadSize);
+        } else if (burst < readSize_ / 4) {
+            // Shrink after bursts well below the current size
+            readSize_ = std::max(readSize_ / 2, kMinReadSize);
+        }
+
+        // The callback may destroy this stream
+        if (readCallback_ && !deliver()) {
+            return;
         }
-        if (nread < sizeof(buf)) {
+        // Edge-triggered bases do not report data or EOF that arrived
+        // along with what was just read, so read until the socket is empty
+        if (!filled && !base_->edgeTriggered()) {
             break;
         }
     }
 }
 
+StreamImpl::FrameStatus StreamImpl::nextFrame(size_t *skip, size_t *size) {
+    const size_t avail = readBuffer_.size();
+    const size_t limit = framing_.size;
+    *skip = 0;
+
+    switch (framing_.mode) {
+    case ReadFraming::Mode::FIXED:
+        if (avail < limit) {
+            return FrameStatus::INCOMPLETE;
+        }
+        *size = limit;
+        return FrameStatus::READY;
+    case ReadFraming::Mode::DELIMITED: {
+        // Resume the search where the last one stopped
+        BufferCursor cursor = readBuffer_.cursor();
+        cursor.advance(scanned_);
+        if (!cursor.find(framing_.delimiter)) {
+            scanned_ = avail;
+            if (limit != 0 && avail >= limit) {
+                return FrameStatus::TOO_LARGE;
+            }
+            return FrameStatus::INCOMPLETE;
+        }
+        scanned_ = 0;
+        *size = cursor.position() + 1;
+        if (limit != 0 && *size > limit) {
+            return FrameStatus::TOO_LARGE;
+        }
+        return FrameStatus::READY;
+    }
+    case ReadFraming::Mode::LENGTH_PREFIXED: {
+        const unsigned width = framing_.prefixWidth;
+        if (avail < width) {
+            return FrameStatus::INCOMPLETE;
+        }
+        uint8_t prefix[8];
+        size_t nread = 0;
+        readBuffer_.peek(reinterpret_cast<char*>(prefix), width, &nread);
+        uint64_t length = 0;
+        for (unsigned i = 0; i < width; ++i) {
+            unsigned shift = framing_.endian == ReadFraming::Endian::BIG ?
+                (width - 1 - i) * 8 : i * 8;
+            length |= static_cast<uint64_t>(prefix[i]) << shift;
+        }
+        if (limit != 0 && length > limit) {
+            return FrameStatus::TOO_LARGE;
+        }
+        if (avail - width < length) {
+            return FrameStatus::INCOMPLETE;
+        }
+        *skip = width;
+        *size = length;
+        return FrameStatus::READY;
+    }
+    default:
+        return FrameStatus::INCOMPLETE;
+    }
+}
+
+bool StreamImpl::deliver() {
+    std::weak_ptr<StreamImpl*> token = token_;
+    if (framing_.mode == ReadFraming::Mode::NONE) {
+        readCallback_->available(&readBuffer_);
+        return !token.expired();
+    }
+
+    while (readCallback_) {
+        size_t skip = 0;
+        size_t size = 0;
+        FrameStatus status = nextFrame(&skip, &size);
+        if (status == FrameStatus::INCOMPLETE) {
+            break;
+        } else if (status == FrameStatus::TOO_LARGE) {
+            ReadCallback *cb = readCallback_;
+            stopRead();
+            cb->error(std::runtime_error("Frame exceeds maximum size"));
+            return !token.expired();
+        }
+
+        readBuffer_.drain(skip);
+        readBuffer_.splitFront(size, &frame_);
+        readCallback_->available(&frame_);
+        if (token.expired()) {
+            return false;
+        }
+        // Unconsumed frame data are discarded
+        frame_.drain(frame_.size());
+    }
+    return true;
+}
+
 void StreamImpl::connectHelper() {
     assert(connectCallback_);
 
@@ -361,61 +1074,458 @@ void StreamImpl::connectHelper() {
 }
 
 void StreamImpl::writeHelper() {
-    WriteRequest *req = requests_.head;
-    std::vector<Extent> extents;
-    bool blocked = false;
-    bool failed = false;
-    while (req) {
-        extents.clear();
-        // TODO: better limit
-        req->buffer_.peek(std::numeric_limits<size_t>::max(), &extents);
-        assert(!extents.empty());
-
-        // TODO: writev
-        size_t total_written = 0;
-        for (auto& extent : extents) {
-            int written = xwrite(handler_.fd(), extent.data, extent.size);
-            if (written >= 0) {
-                total_written += written;
-                if (written < extent.size) {
-                    blocked = true;
-                }
-            } else {
-                failed = true;
+    while (requests_.head) {
+        if (requests_.head->fileBacked()) {
+            if (!sendFileHelper()) {
+                return;
+            }
+            continue;
+        }
+        if (wantsZeroCopy(requests_.head)) {
+            if (!sendZeroCopy()) {
+                return;
+            }
+            continue;
+        }
+
+        // Gather as many queued requests as fit in a single writev, up to
+        // the next file-backed or zero-copy request
+        writeExtents_.clear();
+        size_t total = 0;
+        for (WriteRequest *req = requests_.head; req; req = req->next_) {
+            if (req->fileBacked() || wantsZeroCopy(req)
+                    || total >= kMaxWriteSize
+                    || writeExtents_.size() >= kMaxIoExtents) {
                 break;
             }
+            size_t first = writeExtents_.size();
+            req->buffer_.peek(kMaxWriteSize - total, &writeExtents_);
+            writeExtents_.resize(std::min(writeExtents_.size(),
+                kMaxIoExtents));
+            for (size_t i = first; i < writeExtents_.size(); ++i) {
+                total += writeExtents_[i].size;
+            }
         }
 
-        req->buffer_.drain(total_written);
+        size_t written = 0;
+        if (total > 0) {
+            int rc = xwritev(handler_.fd(), writeExtents_.data(),
+                writeExtents_.size());
+            if (rc < 0) {
+                if (isWriteRetryable(evutil_socket_geterror(handler_.fd()))) {
+                    return;
+                }
+                if (requests_.head->callback_) {
+                    // TODO: better errors
+                    requests_.head->callback_->error(
+                        std::runtime_error("Write failed"));
+                }
+                return;
+            }
+            written = rc;
+            if (!writeDrained(written)) {
+                return;
+            }
+        }
+        size_t remaining = written;
 
-        if (blocked || failed) {
-            break;
+        // Inline writes preceded everything that is queued
+        if (!completed_.empty() && !flushCompletions()) {
+            return;
         }
 
+        // Distribute the write across requests, completing them in order
+        for (;;) {
+            WriteRequest *req = requests_.head;
+            size_t consumed = std::min(remaining, req->buffer_.size());
+            req->buffer_.drain(consumed);
+            remaining -= consumed;
+            if (!req->buffer_.empty()) {
+                if (written < total) {
+                    // The socket buffer is full
+                    return;
+                }
+                // Only the gather limit was reached; write more
+                break;
+            }
+
+            WriteCallback *cb = req->callback_;
+            // Must not touch req after this call
+            WriteRequest *next = requests_.consumeFront();
+            if (!next) {
+                // Uninstall the write handler before invoking the callback
+                // for this final request; callbacks that know that they are
+                // last invocation may legitimately do destructive things like
+                // freeing this stream.
+                base_->registerHandler(&handler_,
+                    removeWrite(handler_.watched()));
+                completeWrite(cb);
+                return;
+            }
+
+            completeWrite(cb);
+
+            if (next->fileBacked() || wantsZeroCopy(next)
+                    || (remaining == 0 && !next->buffer_.empty())) {
+                break;
+            }
+        }
+
+        if (written < total) {
+            // The socket buffer is full
+            return;
+        }
+    }
+}
+
+bool StreamImpl::sendFileHelper() {
+#if defined(HAVE_SENDFILE)
+    WriteRequest *req = requests_.head;
+    size_t sent = 0;
+    bool ok = sendRange(handler_.fd(), &req->file_, &sent);
+    if (sent > 0 && !writeDrained(sent)) {
+        return false;
+    }
+    if (!ok) {
+        // Drop the request, so that its error is raised once; any later
+        // requests are written on the next notification
         WriteCallback *cb = req->callback_;
-        // Must not touch req after this call
-        WriteRequest *next = requests_.consumeFront();
-        if (!next) {
-            // Uninstall the write handler before invoking the callback
-            // for this final request; callbacks that know that they are
-            // last invocation may legitimately do destructive things like
-            // freeing this stream.
+        size_t unsent = req->file_.size;
+        if (!requests_.consumeFront()) {
             base_->registerHandler(&handler_, removeWrite(handler_.watched()));
         }
+        if (!writeDrained(unsent)) {
+            return false;
+        }
+        if (cb) {
+            // TODO: better errors
+            cb->error(std::runtime_error("Write failed"));
+        }
+        return false;
+    }
+    if (req->file_.size > 0) {
+        // Wait for the descriptor to drain
+        return false;
+    }
+
+    // Inline writes preceded everything that is queued
+    if (!completed_.empty() && !flushCompletions()) {
+        return false;
+    }
+
+    WriteCallback *cb = req->callback_;
+    WriteRequest *next = requests_.consumeFront();
+    if (!next) {
+        // As in writeHelper, the final callback may destroy this stream
+        base_->registerHandler(&handler_, removeWrite(handler_.watched()));
+    }
+    completeWrite(cb);
+    return next != nullptr;
+#else
+    return false;
+#endif
+}
+
+void StreamImpl::completeWrite(WriteCallback *cb) {
+    if (!cb) {
+        return;
+    }
+    if (pinned_.head) {
+        WriteRequest *marker = pinned_.pool->get();
+        marker->callback_ = cb;
+        pinned_.append(marker);
+        return;
+    }
+    cb->complete(this);
+}
+
+bool StreamImpl::wantsZeroCopy(WriteRequest const *req) const {
+#if defined(HAVE_MSG_ZEROCOPY)
+    return zeroCopyThreshold_ != 0 && !req->fileBacked()
+        && req->buffer_.size() >= zeroCopyThreshold_;
+#else
+    return false;
+#endif
+}
+
+bool StreamImpl::sendZeroCopy() {
+#if defined(HAVE_MSG_ZEROCOPY)
+    if (!zeroCopyEnabled_) {
+        if (!xenableZeroCopy(handler_.fd())) {
+            // Unsupported by this socket; copy instead
+            zeroCopyThreshold_ = 0;
+            return true;
+        }
+        zeroCopyEnabled_ = true;
+    }
+
+    WriteRequest *req = requests_.head;
+    writeExtents_.clear();
+    req->buffer_.peek(kMaxWriteSize, &writeExtents_);
+    writeExtents_.resize(std::min(writeExtents_.size(), kMaxIoExtents));
+    size_t total = 0;
+    for (auto const& extent : writeExtents_) {
+        total += extent.size;
+    }
+
+    bool pinned = true;
+    int rc = xsendZeroCopy(handler_.fd(), writeExtents_.data(),
+        writeExtents_.size());
+    if (rc < 0 && evutil_socket_geterror(handler_.fd()) == ENOBUFS) {
+        // Too many pages are pinned; copy this chunk instead
+        pinned = false;
+        rc = xwritev(handler_.fd(), writeExtents_.data(),
+            writeExtents_.size());
+    }
+    if (rc < 0) {
+        if (isWriteRetryable(evutil_socket_geterror(handler_.fd()))) {
+            return false;
+        }
+        if (req->callback_) {
+            // TODO: better errors
+            req->callback_->error(std::runtime_error("Write failed"));
+        }
+        return false;
+    }
 
+    size_t written = rc;
+    if (pinned) {
+        // Keep the sent data referenced until the kernel releases it
+        WriteRequest *pin = pinned_.pool->get();
+        req->buffer_.shareRange(0, written, &pin->buffer_);
+        pin->zeroCopySeq_ = zeroCopySeq_++;
+        pin->inFlight_ = true;
+        pinned_.append(pin);
+        watchCompletions();
+    }
+    req->buffer_.drain(written);
+    if (!writeDrained(written)) {
+        return false;
+    }
+
+    // Inline writes preceded everything that is queued
+    if (!completed_.empty() && !flushCompletions()) {
+        return false;
+    }
+    if (!req->buffer_.empty()) {
+        // Continue unless the socket buffer is full
+        return written == total;
+    }
+
+    WriteCallback *cb = req->callback_;
+    WriteRequest *next = requests_.consumeFront();
+    if (!next) {
+        base_->registerHandler(&handler_, removeWrite(handler_.watched()));
+    }
+    completeWrite(cb);
+    return next != nullptr;
+#else
+    return false;
+#endif
+}
+
+bool StreamImpl::releaseZeroCopy() {
+#if defined(HAVE_MSG_ZEROCOPY)
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+    while (xreadZeroCopyCompletion(handler_.fd(), &lo, &hi) > 0) {
+        // Ranges of sequence numbers, which may wrap
+        for (WriteRequest *req = pinned_.head; req; req = req->next_) {
+            if (req->inFlight_ && req->zeroCopySeq_ - lo <= hi - lo) {
+                req->inFlight_ = false;
+            }
+        }
+    }
+
+    std::weak_ptr<StreamImpl*> token = token_;
+    while (pinned_.head && !pinned_.head->inFlight_) {
+        WriteCallback *cb = pinned_.head->callback_;
+        pinned_.consumeFront();
         if (cb) {
             cb->complete(this);
+            if (token.expired()) {
+                return false;
+            }
         }
+    }
+    if (!pinned_.head && !readCallback_) {
+        base_->registerHandler(&handler_, removeRead(handler_.watched()));
+    }
+#endif
+    return true;
+}
+
+void StreamImpl::leaveInputUnread() {
+#if defined(HAVE_MSG_ZEROCOPY)
+    if (base_->edgeTriggered() || !xreadPending(handler_.fd())) {
+        return;
+    }
+    inputWaiting_ = true;
+    base_->registerHandler(&handler_, removeRead(handler_.watched()));
+    watchCompletions();
+#endif
+}
 
-        req = next;
+void StreamImpl::watchCompletions() {
+    if (inputWaiting_) {
+        struct timeval tv { 0, kCompletionPollMicros };
+        base_->registerTimeout(&completionTimeout_, &tv);
+    } else {
+        base_->registerHandler(&handler_, ensureRead(handler_.watched()));
     }
+}
 
-    if (failed && req->callback_) {
+#if defined(HAVE_IO_URING)
+void StreamImpl::submitRecv() {
+    if (!recv_) {
+        recv_ = new RecvOp(this);
+    }
+    if (recv_->pending_) {
+        return;
+    }
+    recv_->pending_ = true;
+    uring_->submitRecv(recv_, handler_.fd(), recv_->buf_,
+        sizeof(recv_->buf_));
+}
+
+void StreamImpl::recvComplete(int result) {
+    if (result > 0) {
+        readBuffer_.append(recv_->buf_, result);
+        if (readCallback_) {
+            // Keep a receive outstanding while reading. Submitted first, as
+            // the callback may close or destroy this stream.
+            submitRecv();
+            deliver();
+        }
+    } else if (result == 0) {
+        if (readCallback_) {
+            readCallback_->eof();
+        }
+    } else if (result == -EAGAIN || result == -EINTR) {
+        if (readCallback_) {
+            submitRecv();
+        }
+    } else if (result != -ECANCELED && readCallback_) {
         // TODO: better errors
-        req->callback_->error(std::runtime_error("Write failed"));
+        readCallback_->error(std::runtime_error("Read failed"));
+    }
+}
+
+void StreamImpl::submitSend() {
+    if (!send_) {
+        send_ = new SendOp(this);
+    }
+    if (send_->pending_ || !requests_.head) {
+        return;
+    }
+
+    // Gather as many queued requests as fit in a single sendmsg
+    send_->iov_.clear();
+    for (WriteRequest *req = requests_.head; req; req = req->next_) {
+        send_->extents_.clear();
+        req->buffer_.peek(std::numeric_limits<size_t>::max(),
+            &send_->extents_);
+        for (auto const& extent : send_->extents_) {
+            if (send_->iov_.size() == IOV_MAX) {
+                break;
+            }
+            send_->iov_.push_back({ extent.data, extent.size });
+        }
+        if (send_->iov_.size() == IOV_MAX) {
+            break;
+        }
+    }
+
+    memset(&send_->msg_, 0, sizeof(send_->msg_));
+    send_->msg_.msg_iov = send_->iov_.data();
+    send_->msg_.msg_iovlen = send_->iov_.size();
+    send_->pending_ = true;
+    uring_->submitSendmsg(send_, handler_.fd(), &send_->msg_);
+}
+
+void StreamImpl::sendComplete(int result) {
+    if (result == -EAGAIN || result == -EINTR) {
+        submitSend();
+        return;
+    } else if (result < 0) {
+        if (result != -ECANCELED && requests_.head &&
+                requests_.head->callback_) {
+            // TODO: better errors
+            requests_.head->callback_->error(
+                std::runtime_error("Write failed"));
+        }
+        return;
+    }
+
+    // Retire the requests covered by this send, in order
+    size_t remaining = result;
+    std::vector<WriteCallback*> completed;
+    WriteRequest *req = requests_.head;
+    while (req) {
+        size_t count = std::min(remaining, req->buffer_.size());
+        req->buffer_.drain(count);
+        remaining -= count;
+        if (!req->buffer_.empty()) {
+            break;
+        }
+        completed.push_back(req->callback_);
+        req = requests_.consumeFront();
+    }
+
+    // Queue the remainder before invoking callbacks; the final callback may
+    // legitimately destroy this stream
+    submitSend();
+    if (!writeDrained(result)) {
+        return;
+    }
+
+    for (WriteCallback *cb : completed) {
+        if (cb) {
+            cb->complete(this);
+        }
+    }
+}
+
+void StreamImpl::connectComplete(int result) {
+    auto *cb = connectCallback_;
+    connectCallback_ = nullptr;
+    if (!cb) {
+        return;
+    }
+    if (result == 0) {
+        cb->complete();
+    } else {
+        cb->error(std::runtime_error("Connection failed"));
     }
 }
 
+void StreamImpl::orphanOps() {
+    if (send_ && send_->pending_) {
+        // The kernel may still read the queued data until the send is
+        // cancelled; hand the buffers to the operation
+        for (WriteRequest *req = requests_.head; req; req = req->next_) {
+            send_->keep_.append(&req->buffer_);
+        }
+    }
+
+    UringOp *ops[] = { recv_, send_, connect_ };
+    for (UringOp *op : ops) {
+        if (!op) {
+            continue;
+        }
+        if (op->pending_) {
+            op->stream_ = nullptr;
+            uring_->cancel(op);
+        } else {
+            delete op;
+        }
+    }
+    recv_ = nullptr;
+    send_ = nullptr;
+    connect_ = nullptr;
+}
+#endif
+
 void Stream::Deleter::operator()(Stream *stream) {
     delete stream;
 }
@@ -0,0 +1,357 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+
+#include "timeout_impl.h"
+
+namespace wte {
+
+namespace {
+
+inline int countTrailingZeros(uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// @return the first set position at or after `from`, or -1
+int findSet(uint64_t const *bits, size_t words, size_t from) {
+    size_t w = from / 64;
+    uint64_t word = bits[w] & (~0ULL << (from % 64));
+    for (;;) {
+        if (word) {
+            return static_cast<int>(w * 64 + countTrailingZeros(word));
+        }
+        if (++w == words) {
+            return -1;
+        }
+        word = bits[w];
+    }
+}
+
+} // unnamed namespace
+
+class TimerWheel::WheelTimeout final : public TimeoutImpl, public Link {
+public:
+    WheelTimeout(TimerWheel *wheel, Timeout *timeout)
+            : wheel_(wheel), timeout_(timeout), expiry_(0), level_(-1),
+              slot_(0), registered_(false) {
+        prev = next = nullptr;
+    }
+
+    ~WheelTimeout() {
+        if (registered_ && wheel_) {
+            wheel_->unlink(this);
+            --wheel_->count_;
+        }
+    }
+
+    EventBase* base() override { return wheel_ ? wheel_->base_ : nullptr; }
+
+    TimerWheel *wheel_;
+    Timeout *timeout_;
+    uint64_t expiry_;
+    // Position in the wheel; level -1 if detached for firing
+    int level_;
+    size_t slot_;
+    bool registered_;
+};
+
+TimerWheel::TimerWheel(EventBase *base, unsigned tickMillis)
+        : base_(base),
+          tick_(std::chrono::milliseconds(std::max(1u, tickMillis))),
+          origin_(Clock::now()), now_(0), count_(0) {
+    for (int level = 0; level < kLevels; ++level) {
+        for (size_t slot = 0; slot < kSlots; ++slot) {
+            slots_[level][slot].init();
+        }
+    }
+    memset(occupied_, 0, sizeof(occupied_));
+}
+
+TimerWheel::~TimerWheel() {
+    // Orphan any armed timeouts, which may outlive the wheel
+    for (int level = 0; level < kLevels; ++level) {
+        for (size_t slot = 0; slot < kSlots; ++slot) {
+            Link *head = &slots_[level][slot];
+            for (Link *cur = head->next; cur != head; cur = cur->next) {
+                WheelTimeout *node = static_cast<WheelTimeout*>(cur);
+                node->registered_ = false;
+                node->wheel_ = nullptr;
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::currentTick() const {
+    return (Clock::now() - origin_) / tick_;
+}
+
+TimerWheel::Clock::time_point TimerWheel::tickTime(uint64_t tick) const {
+    return origin_ + tick_ * tick;
+}
+
+void TimerWheel::link(WheelTimeout *node) {
+    // Timeouts beyond the horizon are parked at its edge, and re-linked
+    // from their true expiry when cascaded
+    const uint64_t horizon = (1ULL << (kSlotBits * kLevels)) - 1;
+    uint64_t expiry = node->expiry_;
+    if (expiry - now_ > horizon) {
+        expiry = now_ + horizon;
+    }
+
+    uint64_t delta = expiry - now_;
+    int level = 0;
+    while (delta >= (1ULL << (kSlotBits * (level + 1)))) {
+        ++level;
+    }
+    size_t slot = (expiry >> (kSlotBits * level)) & kSlotMask;
+
+    Link *head = &slots_[level][slot];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+    occupied_[level][slot / 64] |= 1ULL << (slot % 64);
+
+    node->level_ = level;
+    node->slot_ = slot;
+}
+
+void TimerWheel::unlink(WheelTimeout *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+
+    if (node->level_ >= 0 && slots_[node->level_][node->slot_].empty()) {
+        occupied_[node->level_][node->slot_ / 64] &=
+            ~(1ULL << (node->slot_ % 64));
+    }
+}
+
+void TimerWheel::cascade(int level, size_t slot) {
+    Link *head = &slots_[level][slot];
+    if (head->empty()) {
+        return;
+    }
+
+    // Detach the slot, then redistribute relative to the current tick
+    Link pending;
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    head->init();
+    occupied_[level][slot / 64] &= ~(1ULL << (slot % 64));
+
+    while (!pending.empty()) {
+        WheelTimeout *node = static_cast<WheelTimeout*>(pending.next);
+        node->level_ = -1;
+        unlink(node);
+        link(node);
+    }
+}
+
+void TimerWheel::add(Timeout *timeout, struct timeval *duration) {
+    WheelTimeout *node = nullptr;
+    {
+        auto* impl = TimeoutImpl::get(timeout);
+        if (!impl) {
+            node = new WheelTimeout(this, timeout);
+            TimeoutImpl::set(timeout, node);
+        } else {
+            node = static_cast<WheelTimeout*>(impl);
+            if (!node->wheel_) {
+                // Orphaned by a destroyed base
+                node->wheel_ = this;
+            }
+            assert(node->wheel_ == this);
+        }
+    }
+
+    if (node->registered_) {
+        unlink(node);
+    } else {
+        if (count_ == 0) {
+            // Nothing to fire in between; skip ahead
+            now_ = std::max(now_, currentTick());
+        }
+        ++count_;
+        node->registered_ = true;
+    }
+
+    // Fire on the first tick boundary at or after the deadline
+    auto offset = Clock::now() - origin_ +
+        std::chrono::seconds(duration->tv_sec) +
+        std::chrono::microseconds(duration->tv_usec);
+    uint64_t expiry = (offset + tick_ - Clock::duration(1)) / tick_;
+    node->expiry_ = std::max(expiry, now_ + 1);
+
+    link(node);
+}
+
+void TimerWheel::remove(Timeout *timeout) {
+    auto* impl = TimeoutImpl::get(timeout);
+    if (!impl) {
+        return;
+    }
+
+    if (!impl->base()) {
+        return;
+    }
+
+    assert(impl->base() == base_);
+
+    WheelTimeout *node = static_cast<WheelTimeout*>(impl);
+    if (!node->registered_) {
+        return;
+    }
+    unlink(node);
+    node->registered_ = false;
+    --count_;
+}
+
+uint64_t TimerWheel::nextTick() const {
+    const size_t words = kSlots / 64;
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < kLevels; ++level) {
+        const int shift = kSlotBits * level;
+        size_t current = (now_ >> shift) & kSlotMask;
+
+        // Slots are ordered cyclically after the current one
+        size_t from = (current + 1) & kSlotMask;
+        int slot = findSet(occupied_[level], words, from);
+        if (slot < 0) {
+            slot = findSet(occupied_[level], words, 0);
+        }
+        if (slot < 0) {
+            continue;
+        }
+
+        uint64_t tick;
+        if (level == 0) {
+            tick = now_ + ((slot - current) & kSlotMask);
+            if (tick == now_) {
+                tick += kSlots;
+            }
+        } else {
+            // The tick at which the slot cascades
+            const uint64_t period = 1ULL << (shift + kSlotBits);
+            tick = (now_ & ~(period - 1)) + (static_cast<uint64_t>(slot) << shift);
+            if (tick <= now_) {
+                tick += period;
+            }
+        }
+        next = std::min(next, tick);
+    }
+    return next;
+}
+
+int TimerWheel::waitMillis() const {
+    if (count_ == 0) {
+        return -1;
+    }
+
+    auto now = Clock::now();
+    auto deadline = tickTime(nextTick());
+    if (deadline <= now) {
+        return 0;
+    }
+
+    // Round up; waking early would only spin back into the wait
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+        deadline - now).count();
+    return static_cast<int>(std::min<int64_t>((usec + 999) / 1000, INT_MAX));
+}
+
+size_t TimerWheel::expire() {
+    const uint64_t target = currentTick();
+    size_t fired = 0;
+
+    while (now_ < target) {
+        if (count_ == 0) {
+            now_ = target;
+            break;
+        }
+
+        bool idle = true;
+        for (size_t w = 0; w < kSlots / 64; ++w) {
+            idle = idle && occupied_[0][w] == 0;
+        }
+        if (idle) {
+            // Nothing can fire before the next cascade
+            uint64_t boundary = (now_ | kSlotMask) + 1;
+            if (boundary > target) {
+                now_ = target;
+                break;
+            }
+            now_ = boundary - 1;
+        }
+
+        ++now_;
+        size_t index = now_ & kSlotMask;
+        for (int level = 1; index == 0 && level < kLevels; ++level) {
+            index = (now_ >> (kSlotBits * level)) & kSlotMask;
+            cascade(level, index);
+        }
+        index = now_ & kSlotMask;
+
+        Link *head = &slots_[0][index];
+        if (head->empty()) {
+            continue;
+        }
+
+        // Detach the slot, so that callbacks may freely re-arm or cancel
+        // any timeout
+        Link pending;
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        head->init();
+        occupied_[0][index / 64] &= ~(1ULL << (index % 64));
+        for (Link *cur = pending.next; cur != &pending; cur = cur->next) {
+            static_cast<WheelTimeout*>(cur)->level_ = -1;
+        }
+
+        while (!pending.empty()) {
+            WheelTimeout *node = static_cast<WheelTimeout*>(pending.next);
+            unlink(node);
+            node->registered_ = false;
+            --count_;
+            ++fired;
+
+            node->timeout_->expired();
+        }
+    }
+    return fired;
+}
+
+} // wte namespace
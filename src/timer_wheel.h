@@ -0,0 +1,123 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_TIMER_WHEEL_H_
+#define SRC_TIMER_WHEEL_H_
+
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+
+#include "wte/porting.h"
+#include "wte/timeout.h"
+
+namespace wte {
+
+class EventBase;
+
+/**
+ * A hierarchical timing wheel.
+ *
+ * Time is divided into ticks of configurable granularity; timeouts fire on
+ * the first tick at or after their deadline. Four levels of 256 slots each
+ * cover 2^32 ticks, and timeouts beyond that horizon are parked in the top
+ * level until they come within range. Arming, re-arming and cancelling are
+ * constant time; timeouts in the upper levels are cascaded into lower
+ * levels as the wheel turns.
+ *
+ * The owning base drives the wheel by waiting at most `waitMillis` and then
+ * invoking `expire`. Not thread safe; only used from the loop thread.
+ */
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @param base the owning event base
+     * @param tickMillis the tick granularity, in milliseconds
+     */
+    TimerWheel(EventBase *base, unsigned tickMillis);
+    ~TimerWheel();
+
+    TimerWheel(TimerWheel const&) = delete;
+    TimerWheel& operator=(TimerWheel const&) = delete;
+
+    /** Arm (or re-arm) `timeout` to fire after `duration`. */
+    void add(Timeout *timeout, struct timeval *duration);
+
+    /** Disarm `timeout`. Idempotent. */
+    void remove(Timeout *timeout);
+
+    /** @return whether no timeouts are armed. */
+    bool empty() const { return count_ == 0; }
+
+    /**
+     * @return milliseconds until the wheel next needs to turn, rounded up;
+     *         0 if a timeout has already expired, or -1 if none are armed
+     */
+    int waitMillis() const;
+
+    /**
+     * Turn the wheel to the current time, firing expired timeouts.
+     *
+     * @return the number of timeouts that fired
+     */
+    size_t expire();
+private:
+    static const int kLevels = 4;
+    static const int kSlotBits = 8;
+    static const size_t kSlots = 1 << kSlotBits;
+    static const size_t kSlotMask = kSlots - 1;
+
+    // Intrusive list linkage
+    struct Link {
+        Link *prev;
+        Link *next;
+
+        void init() { prev = next = this; }
+        bool empty() const { return next == this; }
+    };
+
+    class WheelTimeout;
+
+    uint64_t currentTick() const;
+    Clock::time_point tickTime(uint64_t tick) const;
+
+    void link(WheelTimeout *node);
+    void unlink(WheelTimeout *node);
+    void cascade(int level, size_t slot);
+
+    // The tick by which the wheel must next turn; requires !empty()
+    uint64_t nextTick() const;
+
+    EventBase *base_;
+    Clock::duration tick_;
+    Clock::time_point origin_;
+    // The last tick processed
+    uint64_t now_;
+    size_t count_;
+    Link slots_[kLevels][kSlots];
+    // Occupancy bitmap for each level, for finding the next non-empty slot
+    uint64_t occupied_[kLevels][kSlots / 64];
+};
+
+} // wte namespace
+
+#endif // SRC_TIMER_WHEEL_H_
@@ -0,0 +1,64 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "write_request.h"
+
+namespace wte {
+
+WriteRequestPool::WriteRequestPool(size_t maxFree, size_t maxRetained)
+    : maxFree_(maxFree), maxRetained_(maxRetained), free_(nullptr),
+      freeCount_(0) { }
+
+WriteRequestPool::~WriteRequestPool() {
+    while (free_) {
+        WriteRequest *next = free_->next_;
+        delete free_;
+        free_ = next;
+    }
+}
+
+WriteRequest* WriteRequestPool::get() {
+    if (!free_) {
+        ++stats_.misses;
+        return new WriteRequest();
+    }
+    ++stats_.hits;
+    WriteRequest *req = free_;
+    free_ = req->next_;
+    --freeCount_;
+    req->next_ = nullptr;
+    return req;
+}
+
+void WriteRequestPool::put(WriteRequest *req) {
+    if (freeCount_ == maxFree_) {
+        delete req;
+        return;
+    }
+    req->buffer_.clear(maxRetained_);
+    req->file_ = WriteRequest::FileRange();
+    req->callback_ = nullptr;
+    req->inFlight_ = false;
+    req->next_ = free_;
+    free_ = req;
+    ++freeCount_;
+}
+
+} // wte namespace
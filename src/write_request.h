@@ -0,0 +1,110 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_WRITE_REQUEST_H_
+#define SRC_WRITE_REQUEST_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "buffer-internal.h"
+#include "wte/stream.h"
+
+namespace wte {
+
+/**
+ * A queued stream write: the unsent data and the completion callback.
+ *
+ * The data are either held in `buffer_` or, for file-backed requests, are
+ * the unsent range of `file_`.
+ */
+class WriteRequest final {
+public:
+    struct FileRange {
+        int fd = -1;
+        off_t offset = 0;
+        size_t size = 0;
+    };
+
+    WriteRequest() : callback_(nullptr), next_(nullptr), zeroCopySeq_(0),
+        inFlight_(false) { }
+
+    bool fileBacked() const { return file_.fd != -1; }
+
+    /** @return the unsent bytes. */
+    size_t size() const { return buffer_.size() + file_.size; }
+
+    BufferImpl buffer_;
+    FileRange file_;
+    Stream::WriteCallback *callback_;
+    WriteRequest *next_;
+    // For zero-copy sends, the sequence number of the send of `buffer_` and
+    // whether the kernel may still reference it
+    uint32_t zeroCopySeq_;
+    bool inFlight_;
+};
+
+/**
+ * Freelist of write requests, shared by the streams of an event base.
+ *
+ * Recycled requests keep the last extent of their buffer, so steady-state
+ * writes of similar sizes allocate neither the request nor its storage.
+ * Only used on the event loop thread.
+ */
+class WriteRequestPool final {
+public:
+    struct Stats {
+        /** Requests served from the freelist. */
+        size_t hits = 0;
+        /** Requests that had to be allocated. */
+        size_t misses = 0;
+    };
+
+    /**
+     * @param maxFree the most requests kept on the freelist
+     * @param maxRetained the largest extent a free request may keep
+     */
+    explicit WriteRequestPool(size_t maxFree = 64,
+        size_t maxRetained = 16 * 1024);
+    ~WriteRequestPool();
+
+    WriteRequestPool(WriteRequestPool const&) = delete;
+    WriteRequestPool& operator=(WriteRequestPool const&) = delete;
+
+    /** @return an empty request. */
+    WriteRequest* get();
+
+    /** Return a request that is no longer queued. */
+    void put(WriteRequest *req);
+
+    Stats const& stats() const { return stats_; }
+private:
+    const size_t maxFree_;
+    const size_t maxRetained_;
+    WriteRequest *free_;
+    size_t freeCount_;
+    Stats stats_;
+};
+
+} // wte namespace
+
+#endif // SRC_WRITE_REQUEST_H_
@@ -25,11 +25,13 @@
 
 #include <sys/types.h>
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector> // TODO: erg, not a stable interface...
 
 #include "wte/porting.h"
+#include "wte/task.h"
 
 namespace wte {
 
@@ -42,6 +44,73 @@ struct WTE_SYM Extent {
 
 class BufferImpl;
 
+/**
+ * A forward position within the data of a `Buffer`.
+ *
+ * Cursors walk the buffer's extents in place, without copying or
+ * allocating. The position may be passed to `Buffer::drain` or
+ * `Buffer::splitFront` to consume the data before it. Any modification of
+ * the buffer invalidates its cursors.
+ */
+class WTE_SYM BufferCursor {
+public:
+    /** @return the offset of the cursor from the start of the data. */
+    size_t position() const { return position_; }
+
+    /** @return whether the cursor is past the last byte. */
+    bool atEnd() const { return extent_ == head_; }
+
+    /** @return the byte at the cursor, which must not be at the end. */
+    char operator*() const;
+
+    /**
+     * Advance the cursor.
+     *
+     * @param size the number of bytes to skip
+     * @return the number of bytes skipped, less than `size` at the end
+     */
+    size_t advance(size_t size);
+
+    /**
+     * Advance to the next occurrence of `c`, or to the end.
+     *
+     * @return whether `c` was found
+     */
+    bool find(char c);
+
+    /**
+     * Advance to the start of the next occurrence of `pattern`, or to the
+     * end.
+     *
+     * @return whether the pattern was found
+     */
+    bool find(const char *pattern, size_t size);
+
+    /** @return whether the next `size` bytes equal `data`. */
+    bool compare(const char *data, size_t size) const;
+
+    /**
+     * Copy up to `size` bytes at the cursor, without advancing.
+     *
+     * @return the number of bytes copied
+     */
+    size_t copyTo(char *out, size_t size) const;
+private:
+    friend class BufferImpl;
+
+    BufferCursor(const void *head, const void *extent);
+
+    // Skip exhausted extents
+    void normalize();
+
+    // Opaque BufferImpl extents: the list sentinel and the current extent
+    const void *head_;
+    const void *extent_;
+    // Offset into the readable data of the current extent
+    size_t offset_;
+    size_t position_;
+};
+
 /**
  * Buffer for aggregating data.
  *
@@ -78,6 +147,36 @@ public:
      */
     virtual void append(Buffer *buffer) = 0;
 
+    /**
+     * Appends external memory to the buffer without copying.
+     *
+     * The memory must remain valid and unmodified until `release` runs,
+     * which happens once the data has been drained from this buffer and
+     * any clones. `release` may run on whichever thread drops the last
+     * reference.
+     *
+     * @param buf the external memory
+     * @param size the size of the external memory
+     * @param release invoked when the memory is no longer referenced
+     */
+    virtual void appendExternal(const char *buf, size_t size,
+        Task && release) = 0;
+
+    /**
+     * Appends a region of a file to the buffer by mapping it into memory.
+     *
+     * The file is not read until the data are accessed. The region must
+     * not be truncated while mapped; it is unmapped once the data have
+     * been drained from this buffer and any clones.
+     *
+     * @param fd the file, open for reading
+     * @param offset the start of the region
+     * @param size the size of the region
+     * @throws std::runtime_error if the region extends beyond the end of
+     *         the file or cannot be mapped
+     */
+    virtual void appendFile(int fd, off_t offset, size_t size) = 0;
+
     /**
      * Prepends data to the buffer.
      *
@@ -131,6 +230,45 @@ public:
      */
     virtual void peek(size_t size, std::vector<Extent> *extents) const = 0;
 
+    /**
+     * Make the first `size` bytes of the buffer contiguous.
+     *
+     * Data is only moved if it spans extents, in which case just enough of
+     * the following extents is copied into the first one, or into a new
+     * extent if it lacks room.
+     *
+     * @return a pointer to the first `size` bytes, valid until the buffer
+     *         is modified, or nullptr if the buffer holds fewer bytes
+     */
+    virtual const char* pullup(size_t size) = 0;
+
+    /** @return a cursor at the start of the data. */
+    virtual BufferCursor cursor() const = 0;
+
+    /**
+     * Find the first occurrence of `c` at or after `offset`.
+     *
+     * @param pos set to the position of the match
+     * @return whether `c` was found
+     */
+    virtual bool find(char c, size_t offset, size_t *pos) const = 0;
+
+    /**
+     * Find the first occurrence of `needle` at or after `offset`, which may
+     * span extents.
+     *
+     * @param pos set to the position of the start of the match
+     * @return whether `needle` was found
+     */
+    virtual bool find(const char *needle, size_t size, size_t offset,
+        size_t *pos) const = 0;
+
+    /**
+     * @return the CRC32C checksum of up to `size` bytes starting at
+     *         `offset`
+     */
+    virtual uint32_t crc32c(size_t offset, size_t size) const = 0;
+
     /**
      * Consume up to `size` bytes of the buffer without reading.
      *
@@ -158,15 +296,62 @@ public:
      * Reserve at least `size` bytes of space in the buffer, returning 1 or
      * more writable extents comprising the reserved region(s).
      *
+     * Data written to the extents become part of the buffer once passed to
+     * `commit`. The extents are invalidated by any other modification of
+     * the buffer.
+     *
      * @param size the space to reserve
      * @param extents the reserved extents
      */
     virtual void reserve(size_t size, std::vector<Extent> *extents) = 0;
 
+    /**
+     * Append `size` bytes written to the extents most recently returned by
+     * `reserve`, without copying.
+     *
+     * The bytes are taken from the start of the extents, in order.
+     *
+     * @param size the number of bytes written; at most the reserved space
+     */
+    virtual void commit(size_t size) = 0;
+
+    /**
+     * Move up to `size` bytes from the front of this buffer to the end of
+     * `out`, without copying the payload.
+     *
+     * Whole extents are transferred. An extent straddling the boundary is
+     * shared between the buffers (see `cloneRange`), or copied if the
+     * piece moved is small.
+     *
+     * @param size the number of bytes to move
+     * @param out the destination buffer
+     */
+    virtual void splitFront(size_t size, Buffer *out) = 0;
+
     struct WTE_SYM Deleter {
         void operator()(Buffer *buf);
     };
 
+    /**
+     * Create a buffer holding a range of this buffer's data, without
+     * copying.
+     *
+     * The buffers share reference-counted storage, which is copied on
+     * write: subsequent modifications of either buffer are not visible in
+     * the other. Clones may be used and released on other threads.
+     *
+     * @param offset the start of the range
+     * @param size the length of the range, truncated at the end of the data
+     * @return the clone
+     */
+    virtual std::unique_ptr<Buffer, Deleter> cloneRange(size_t offset,
+        size_t size) const = 0;
+
+    /** @return a clone of all the data in this buffer; see `cloneRange`. */
+    std::unique_ptr<Buffer, Deleter> clone() const {
+        return cloneRange(0, size());
+    }
+
     static std::unique_ptr<Buffer, Deleter> create() {
         return std::unique_ptr<Buffer, Deleter>(mkBuffer());
     }
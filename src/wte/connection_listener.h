@@ -21,15 +21,31 @@
 #ifndef WTE_CONNECTION_LISTENER_H_
 #define WTE_CONNECTION_LISTENER_H_
 
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#endif
+
 #include <cinttypes>
 #include <functional>
 #include <memory>
+#include <vector>
 
 #include "wte/event_base.h"
+#include "wte/event_base_pool.h"
 #include "wte/porting.h"
 
 namespace wte {
 
+/** A connection accepted by a `ConnectionListener`. */
+struct AcceptedConnection {
+    /** The connection's socket, in non-blocking mode. */
+    int fd;
+    /** The peer address. */
+    struct sockaddr_storage peer;
+    /** The length of `peer`. */
+    socklen_t peerLen;
+};
+
 /**
  * A class that can listen for and accept connections.
  *
@@ -90,6 +106,18 @@ public:
 
     /** @return the bound port. Undefined prior to invoking `bind`. */
     virtual uint16_t port() = 0;
+
+    /**
+     * Set the maximum number of connections accepted per readiness
+     * notification, or 0 to accept until the queue is empty.
+     *
+     * Connections beyond the limit are accepted on a later loop iteration,
+     * so a connection storm cannot starve other handlers. Defaults to
+     * `kDefaultAcceptBatch`.
+     */
+    virtual void setAcceptBatchLimit(size_t limit) = 0;
+
+    static const size_t kDefaultAcceptBatch = 64;
 };
 
 /**
@@ -105,6 +133,62 @@ WTE_SYM std::shared_ptr<ConnectionListener> mkConnectionListener(
     std::function<void(int fd)> const& acceptCallback,
     std::function<void(std::exception const&)> errorCallback);
 
+/**
+ * Construct a connection listener that delivers accepted connections in
+ * batches, one batch per readiness notification.
+ *
+ * The callback owns the sockets in the batch; the vector itself is reused
+ * and is cleared when the callback returns.
+ *
+ * @param base the event base for the listener
+ * @param acceptCallback the callback to be invoked with accepted batches
+ * @param errorCallback the callback to be invoked on errors
+ * @throws on error
+ */
+WTE_SYM std::shared_ptr<ConnectionListener> mkBatchConnectionListener(
+    std::shared_ptr<EventBase> base,
+    std::function<void(std::vector<AcceptedConnection>& batch)> const&
+        acceptCallback,
+    std::function<void(std::exception const&)> errorCallback);
+
+/** Construction options for `mkShardedConnectionListener`. */
+struct ShardedListenerOptions {
+    /**
+     * Steer each connection to the shard whose index matches the processor
+     * that received it, modulo the shard count (Linux only).
+     *
+     * Most effective with a pool whose threads are pinned, so that shard
+     * `i` runs on the `i`th available processor.
+     */
+    bool steerByCpu = false;
+};
+
+/**
+ * Construct a listener with one listening socket per event base in `pool`.
+ *
+ * Each socket is bound to the same address with SO_REUSEPORT, and the
+ * kernel distributes incoming connections among them; every loop accepts
+ * its own connections, without any cross-thread handoff. The accept
+ * callback is invoked on the accepting loop's thread and is passed that
+ * loop's event base. The error callback may be invoked on any of the
+ * pool's threads.
+ *
+ * `startAccepting`, `stopAccepting` and destruction block until every
+ * shard has been updated on its loop.
+ *
+ * @param pool the event bases on which to accept
+ * @param acceptCallback the callback to be invoked on successful accepts
+ * @param errorCallback the callback to be invoked on errors
+ * @param options the listener options
+ * @throws if SO_REUSEPORT is not supported on this platform
+ */
+WTE_SYM std::shared_ptr<ConnectionListener> mkShardedConnectionListener(
+    std::shared_ptr<EventBasePool> pool,
+    std::function<void(std::shared_ptr<EventBase> base, int fd)> const&
+        acceptCallback,
+    std::function<void(std::exception const&)> errorCallback,
+    ShardedListenerOptions const& options = ShardedListenerOptions());
+
 } // wte namespace
 
 #endif // WTE_CONNECTION_LISTENER_H_
@@ -25,6 +25,7 @@
 #include <memory>
 
 #include "wte/porting.h"
+#include "wte/task.h"
 #include "wte/what.h"
 
 namespace wte {
@@ -41,6 +42,16 @@ public:
         UNTIL_EMPTY,
         /** Run the loop forever. */
         FOREVER,
+        /**
+         * Run the loop forever, busy-polling instead of blocking.
+         *
+         * Operations posted from other threads are picked up without a
+         * notification, and ready descriptors without a wakeup, at the
+         * cost of a dedicated core. After `EventBaseOptions::spinIdleMicros`
+         * without activity the loop blocks until the next event, then
+         * resumes spinning.
+         */
+        SPIN,
     };
 
     /**
@@ -77,6 +88,12 @@ public:
      */
     virtual void unregisterHandler(EventHandler *handler) = 0;
 
+    /**
+     * @return whether handlers are notified only when their descriptor
+     *         _becomes_ ready (see `EventBaseOptions::edgeTriggered`)
+     */
+    virtual bool edgeTriggered() const { return false; }
+
     /**
      * Enqueue an operation to run on this event base.
      *
@@ -85,10 +102,20 @@ public:
      * is invoked immediately, without enqueuing, unless the `defer` flag
      * is true.
      *
-     * @return false on error, otherwise true
+     * Any callable is accepted; it is moved (never copied) into a `Task`,
+     * which does not allocate for small closures.
+     *
+     * @return false on error or if the base's bounded notification queue is
+     *         full (see `EventBaseOptions::notifyQueueCapacity`), otherwise
+     *         true
      */
-    virtual bool runOnEventLoop(std::function<void(void)> const& op,
-        bool defer = false) = 0;
+    virtual bool runOnEventLoop(Task && op, bool defer = false) = 0;
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    bool runOnEventLoop(F && op, bool defer = false) {
+        return runOnEventLoop(Task(std::forward<F>(op)), defer);
+    }
 
     /**
      * Enqeue an operation to run on the event base and wait for completion.
@@ -101,8 +128,13 @@ public:
      *
      * @return false on error, otherwise true
      */
-    virtual bool runOnEventLoopAndWait(std::function<void(void)> const& op,
-        bool defer = false) = 0;
+    virtual bool runOnEventLoopAndWait(Task && op, bool defer = false) = 0;
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    bool runOnEventLoopAndWait(F && op, bool defer = false) {
+        return runOnEventLoopAndWait(Task(std::forward<F>(op)), defer);
+    }
 
     /**
      * Registers a timeout on this event base.
@@ -131,9 +163,76 @@ public:
     virtual ~EventBase() { }
 };
 
+/** Event notification mechanisms backing an `EventBase`. */
+enum class Backend {
+    /** Portable libevent-based loop. */
+    LIBEVENT,
+    /**
+     * Native epoll(7) loop (Linux only).
+     *
+     * At most one handler may be registered per file descriptor.
+     */
+    EPOLL,
+    /**
+     * io_uring(7) loop (Linux 5.11+).
+     *
+     * Streams on this backend perform socket I/O with completion-based
+     * operations rather than readiness notification. At most one handler
+     * may be registered per file descriptor.
+     */
+    IO_URING,
+};
+
+/** Construction options for `mkEventBase`. */
+struct EventBaseOptions {
+    /** The event notification mechanism. */
+    Backend backend = Backend::LIBEVENT;
+
+    /**
+     * Use edge-triggered notification, where supported (EPOLL).
+     *
+     * Handlers on an edge-triggered base are only notified when a descriptor
+     * _becomes_ ready, so they must consume input (or fill output) until
+     * the operation would block.
+     */
+    bool edgeTriggered = false;
+
+    /**
+     * Timer granularity, in milliseconds.
+     *
+     * Timeouts are kept in a timer wheel and fire on the first tick at or
+     * after their deadline. Coarser ticks trade precision for fewer wakeups.
+     */
+    unsigned timerTickMillis = 1;
+
+    /**
+     * Capacity of the queue backing `runOnEventLoop`, or 0 for unbounded.
+     *
+     * A bounded queue is a preallocated ring, so posting never allocates
+     * (beyond any large `Task`), but posts fail while it is full. The
+     * capacity is rounded up to a power of two.
+     */
+    size_t notifyQueueCapacity = 0;
+
+    /**
+     * How long a `LoopMode::SPIN` loop polls without finding any work
+     * before blocking, in microseconds. Zero spins indefinitely.
+     */
+    unsigned spinIdleMicros = 1000;
+};
+
 /** @return a new event base. */
 WTE_SYM std::shared_ptr<EventBase> mkEventBase();
 
+/**
+ * Construct an event base with the specified options.
+ *
+ * @param options the construction options
+ * @return a new event base
+ * @throws if the requested backend is unavailable on this platform
+ */
+WTE_SYM std::shared_ptr<EventBase> mkEventBase(EventBaseOptions const& options);
+
 } // wte namespace
 
 #endif // WTE_EVENT_BASE_H_
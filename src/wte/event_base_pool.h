@@ -0,0 +1,106 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WTE_EVENT_BASE_POOL_H_
+#define WTE_EVENT_BASE_POOL_H_
+
+#include <cstddef>
+#include <memory>
+
+#include "wte/event_base.h"
+#include "wte/porting.h"
+
+namespace wte {
+
+/** Construction options for `mkEventBasePool`. */
+struct EventBasePoolOptions {
+    /** Number of event bases, or 0 for one per available processor. */
+    size_t size = 0;
+
+    /**
+     * Pin each loop thread to a single processor, where supported (Linux).
+     *
+     * Threads are assigned round-robin over the processors available to
+     * the process.
+     */
+    bool pinThreads = false;
+
+    /** Options for each event base in the pool. */
+    EventBaseOptions baseOptions;
+};
+
+/**
+ * A fixed set of event bases, each continuously driven by its own thread.
+ *
+ * The loops are running when the pool is returned. A typical use is to
+ * accept connections on one base and hand each accepted descriptor to a
+ * base chosen by `next` or `leastLoaded`, wrapping it in a `Stream` there.
+ *
+ * The selection methods may be invoked from any thread.
+ */
+class EventBasePool {
+public:
+    virtual ~EventBasePool() { }
+
+    /** @return the number of event bases in the pool. */
+    virtual size_t size() const = 0;
+
+    /** @return the event base at `index`, which must be less than `size`. */
+    virtual std::shared_ptr<EventBase> get(size_t index) = 0;
+
+    /** @return the next event base, in round-robin order. */
+    virtual std::shared_ptr<EventBase> next() = 0;
+
+    /**
+     * Select the event base with the fewest outstanding assignments.
+     *
+     * Each call records an assignment against the returned base, which
+     * should be released with `release` when the work it was selected for
+     * (e.g., a connection) finishes.
+     *
+     * @return the least-loaded event base
+     */
+    virtual std::shared_ptr<EventBase> leastLoaded() = 0;
+
+    /** Release an assignment recorded by `leastLoaded`. */
+    virtual void release(EventBase *base) = 0;
+
+    /**
+     * Stop all loops and join their threads.
+     *
+     * Idempotent; invoked by the destructor. Must not be invoked from one
+     * of the pool's loop threads.
+     */
+    virtual void stop() = 0;
+};
+
+/**
+ * Construct an event base pool and start its loops.
+ *
+ * @param options the pool options
+ * @return a running pool
+ * @throws if an event base cannot be created
+ */
+WTE_SYM std::shared_ptr<EventBasePool> mkEventBasePool(
+    EventBasePoolOptions const& options = EventBasePoolOptions());
+
+} // wte namespace
+
+#endif // WTE_EVENT_BASE_POOL_H_
@@ -32,6 +32,42 @@
 
 namespace wte {
 
+/** How a stream divides incoming data into frames; see `setReadFraming`. */
+struct ReadFraming {
+    enum class Mode {
+        /** Deliver data as they arrive. */
+        NONE,
+        /** Frames of exactly `size` bytes. */
+        FIXED,
+        /** Frames ending with (and including) `delimiter`. */
+        DELIMITED,
+        /**
+         * Frames preceded by an unsigned length of `prefixWidth` bytes.
+         * The prefix is not delivered.
+         */
+        LENGTH_PREFIXED,
+    };
+
+    enum class Endian { BIG, LITTLE };
+
+    Mode mode = Mode::NONE;
+
+    /**
+     * The frame size for `FIXED`, otherwise the largest accepted frame
+     * (excluding any length prefix), or 0 for no limit.
+     */
+    size_t size = 0;
+
+    /** Frame terminator for `DELIMITED`. */
+    char delimiter = '\n';
+
+    /** Width of the length prefix in bytes: 1, 2, 4, or 8. */
+    unsigned prefixWidth = 4;
+
+    /** Byte order of the length prefix. */
+    Endian endian = Endian::BIG;
+};
+
 /**
  * Interface for an asynchronous data stream.
  */
@@ -87,6 +123,20 @@ public:
         virtual void eof() = 0;
     };
 
+    /** Back-pressure notifications for queued writes. */
+    class WatermarkCallback {
+    public:
+        /** Invoked when queued write data reach the high watermark. */
+        virtual void full(Stream *) = 0;
+
+        /**
+         * Invoked when queued write data drop to or below the low
+         * watermark, after having reached the high watermark. With a low
+         * watermark of 0, fires once the queue has drained.
+         */
+        virtual void writable(Stream *) = 0;
+    };
+
     class ConnectCallback {
     public:
         /** Invoked when the connection completes successfully. */
@@ -96,10 +146,65 @@ public:
         virtual void error(std::runtime_error const&) = 0;
     };
 
+    /** Delivery of callbacks for writes that complete immediately. */
+    enum class WriteCompletion {
+        /** Invoked from the event loop after `write` returns. */
+        DEFERRED,
+        /** Invoked before `write` returns. */
+        INLINE,
+    };
+
+    /**
+     * Set how completions are delivered for writes that go out in full
+     * without waiting for the descriptor to become writable.
+     *
+     * Defaults to `WriteCompletion::DEFERRED`. Completions of all writes
+     * on a stream are delivered in the order the writes were issued.
+     *
+     * May only be invoked on the stream's event base.
+     */
+    virtual void setWriteCompletion(WriteCompletion completion) = 0;
+
+    /**
+     * @return the number of bytes accepted by `write` but not yet written
+     * to the descriptor.
+     */
+    virtual size_t pendingWriteBytes() const = 0;
+
+    /**
+     * Configure notifications as queued write data grow and drain.
+     *
+     * May only be invoked on the stream's event base.
+     *
+     * @param low the low watermark, at most `high`
+     * @param high the high watermark, or 0 to disable notifications
+     * @param cb the callback (nullable)
+     * @throws if `low` exceeds a nonzero `high`
+     */
+    virtual void setWriteWatermarks(size_t low, size_t high,
+        WatermarkCallback *cb) = 0;
+
+    /**
+     * Limit the data queued for writing.
+     *
+     * A write that would raise `pendingWriteBytes()` above the limit if
+     * queued in full fails before `write` returns, invoking the error
+     * callback without writing any data. This holds even if the write
+     * could have gone out without queueing.
+     *
+     * May only be invoked on the stream's event base.
+     *
+     * @param max the most pending bytes, or 0 for no limit
+     */
+    virtual void setMaxPendingWriteBytes(size_t max) = 0;
+
     /**
      * Write a block of data to the stream, with an optional callback
      * to handle success or failure notification.
      *
+     * If no earlier writes are pending, the data are written immediately
+     * and only the remainder (if any) is queued.
+     *
      * It is the caller's responsibility to ensure that the write callback
      * (if provided) remains live until it is invoked or the stream is closed.
      *
@@ -125,6 +230,43 @@ public:
      */
     virtual void write(Buffer *buf, WriteCallback *cb) = 0;
 
+    /**
+     * Write a region of a file to the stream, with an optional callback
+     * to handle success or failure notification.
+     *
+     * Where supported, the data are sent with sendfile(2) and never copied
+     * into user space; otherwise the region is mapped into a buffer and
+     * written as by `write`. Writes are ordered with other writes.
+     *
+     * The file must remain open and the region unmodified until the
+     * callback is invoked or the stream is closed.
+     * A region that extends beyond the end of the file fails before any
+     * data are written.
+     *
+     * May only be invoked on the stream's event base.
+     *
+     * @param fd the file, open for reading
+     * @param offset the start of the region
+     * @param size the size of the region
+     * @param cb the callback (nullable)
+     */
+    virtual void sendFile(int fd, off_t offset, size_t size,
+        WriteCallback *cb) = 0;
+
+    /**
+     * Send queued writes of at least `size` bytes with MSG_ZEROCOPY.
+     *
+     * The kernel transmits such writes directly from their buffers, which
+     * stay referenced until it reports that the data have been sent. Only
+     * then is the write callback invoked, and the callbacks of later
+     * writes wait behind it. Pinning pages and reading completions costs
+     * more than copying small writes, so the threshold should be large.
+     * Ignored where unsupported, including on completion-based bases.
+     *
+     * @param size the smallest write sent without copying, or 0 to disable
+     */
+    virtual void setZeroCopyThreshold(size_t size) = 0;
+
     /**
      * Starts reading on the stream.
      *
@@ -136,6 +278,22 @@ public:
      */
     virtual void startRead(ReadCallback *cb) = 0;
 
+    /**
+     * Deliver incoming data to the read callback one frame at a time.
+     *
+     * With framing, `ReadCallback::available` fires once per complete
+     * frame, with a buffer holding exactly that frame; any part of it left
+     * unconsumed is discarded. A frame exceeding the configured maximum
+     * stops reading and raises the read callback's error. Data already
+     * buffered are subject to the new framing.
+     *
+     * May only be invoked on the stream's event base.
+     *
+     * @param framing the framing
+     * @throws if the framing is invalid
+     */
+    virtual void setReadFraming(ReadFraming const& framing) = 0;
+
     /**
      * Stop reading the stream.
      *
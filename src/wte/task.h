@@ -0,0 +1,179 @@
+/*
+ * Copyright (©) 2015 Nate Rosenblum
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WTE_TASK_H_
+#define WTE_TASK_H_
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "wte/porting.h"
+
+namespace wte {
+
+/**
+ * A move-only nullary callable, for operations posted to an event loop.
+ *
+ * Unlike `std::function`, a `Task` never copies its target, and stores
+ * callables of up to `kInlineSize` bytes inline, without allocating.
+ * Larger callables (or those that may throw when moved) are held on the
+ * heap.
+ */
+class Task {
+public:
+    /** Capacity for inline callables, in bytes. */
+    static const size_t kInlineSize = 48;
+
+    /** Construct an empty task. */
+    Task() NOEXCEPT : ops_(nullptr) { }
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F && f) : ops_(nullptr) {
+        typedef typename std::decay<F>::type Fn;
+        emplace<Fn>(std::forward<F>(f),
+            std::integral_constant<bool, fitsInline<Fn>()>());
+    }
+
+    Task(Task && o) NOEXCEPT : ops_(o.ops_) {
+        if (ops_) {
+            ops_->move(&storage_, &o.storage_);
+            o.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task && o) NOEXCEPT {
+        if (this != &o) {
+            reset();
+            if (o.ops_) {
+                o.ops_->move(&storage_, &o.storage_);
+                ops_ = o.ops_;
+                o.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(Task const&) = delete;
+    Task& operator=(Task const&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    /**
+     * Invoke the callable.
+     *
+     * @throws std::bad_function_call if the task is empty
+     */
+    void operator()() {
+        if (!ops_) {
+            throw std::bad_function_call();
+        }
+        ops_->invoke(&storage_);
+    }
+
+    /** @return whether the task holds a callable. */
+    explicit operator bool() const NOEXCEPT { return ops_ != nullptr; }
+private:
+    typedef std::aligned_storage<kInlineSize>::type Storage;
+
+    // Manual vtable, shared by all tasks wrapping a given callable type
+    struct Ops {
+        void (*invoke)(void *storage);
+        // Move-construct into `dst` and destroy `src`
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *storage);
+    };
+
+    template<typename Fn>
+    static constexpr bool fitsInline() {
+        return sizeof(Fn) <= sizeof(Storage) &&
+            std::alignment_of<Storage>::value %
+                std::alignment_of<Fn>::value == 0 &&
+            std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<typename Fn>
+    struct InlineOps {
+        static Fn* get(void *storage) { return static_cast<Fn*>(storage); }
+        static void invoke(void *storage) { (*get(storage))(); }
+        static void move(void *dst, void *src) {
+            ::new(dst) Fn(std::move(*get(src)));
+            get(src)->~Fn();
+        }
+        static void destroy(void *storage) { get(storage)->~Fn(); }
+        static Ops const ops;
+    };
+
+    template<typename Fn>
+    struct HeapOps {
+        static Fn*& get(void *storage) { return *static_cast<Fn**>(storage); }
+        static void invoke(void *storage) { (*get(storage))(); }
+        static void move(void *dst, void *src) {
+            ::new(dst) Fn*(get(src));
+        }
+        static void destroy(void *storage) { delete get(storage); }
+        static Ops const ops;
+    };
+
+    template<typename Fn, typename F>
+    void emplace(F && f, std::true_type /* inline */) {
+        ::new(static_cast<void*>(&storage_)) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::ops;
+    }
+
+    template<typename Fn, typename F>
+    void emplace(F && f, std::false_type /* inline */) {
+        ::new(static_cast<void*>(&storage_)) Fn*(new Fn(std::forward<F>(f)));
+        ops_ = &HeapOps<Fn>::ops;
+    }
+
+    void reset() NOEXCEPT {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    Storage storage_;
+    Ops const *ops_;
+};
+
+template<typename Fn>
+Task::Ops const Task::InlineOps<Fn>::ops = {
+    &Task::InlineOps<Fn>::invoke,
+    &Task::InlineOps<Fn>::move,
+    &Task::InlineOps<Fn>::destroy,
+};
+
+template<typename Fn>
+Task::Ops const Task::HeapOps<Fn>::ops = {
+    &Task::HeapOps<Fn>::invoke,
+    &Task::HeapOps<Fn>::move,
+    &Task::HeapOps<Fn>::destroy,
+};
+
+} // wte namespace
+
+#endif // WTE_TASK_H_
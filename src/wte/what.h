@@ -47,6 +47,7 @@ inline bool isWrite(What what) {
 inline What ensureWrite(What what) {
     switch (what) {
     case What::READ:
+    case What::READ_WRITE:
         return What::READ_WRITE;
     default:
         return What::WRITE;
@@ -57,6 +58,7 @@ inline What ensureWrite(What what) {
 inline What ensureRead(What what) {
     switch (what) {
     case What::WRITE:
+    case What::READ_WRITE:
         return What::READ_WRITE;
     default:
         return What::READ;
@@ -73,6 +75,16 @@ inline What removeWrite(What what) {
     }
 }
 
+inline What removeRead(What what) {
+    switch (what) {
+        case What::READ_WRITE:
+        case What::WRITE:
+            return What::WRITE;
+        default:
+            return What::NONE;
+    }
+}
+
 } // wte namespace
 
 #endif // WTE_WHAT_H_
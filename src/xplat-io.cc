@@ -25,9 +25,27 @@
 #if defined(_WIN32)
 #include <winsock2.h>
 #else
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
+#if defined(HAVE_SENDFILE)
+#include <sys/sendfile.h>
+#endif
+
+#if defined(HAVE_MSG_ZEROCOPY)
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+
 namespace wte {
 
 int xwrite(int fd, const void *buf, size_t nbyte) {
@@ -46,6 +64,137 @@ int xread(int fd, void *buf, size_t nbyte) {
 #endif
 }
 
+namespace {
+
+#if defined(_WIN32)
+typedef WSABUF IoVec;
+
+inline void toIoVec(Extent const& extent, IoVec *vec) {
+    vec->len = static_cast<ULONG>(extent.size);
+    vec->buf = extent.data;
+}
+#else
+typedef struct iovec IoVec;
+
+inline void toIoVec(Extent const& extent, IoVec *vec) {
+    vec->iov_base = extent.data;
+    vec->iov_len = extent.size;
+}
+#endif
+
+} // unnamed namespace
+
+int xreadv(int fd, Extent const *extents, size_t count) {
+    IoVec vecs[kMaxIoExtents];
+    count = std::min(count, kMaxIoExtents);
+    for (size_t i = 0; i < count; ++i) {
+        toIoVec(extents[i], &vecs[i]);
+    }
+#if defined(_WIN32)
+    DWORD nread = 0;
+    DWORD flags = 0;
+    if (0 != WSARecv(fd, vecs, static_cast<DWORD>(count), &nread, &flags,
+            nullptr, nullptr)) {
+        return -1;
+    }
+    return static_cast<int>(nread);
+#else
+    return readv(fd, vecs, static_cast<int>(count));
+#endif
+}
+
+int xwritev(int fd, Extent const *extents, size_t count) {
+    IoVec vecs[kMaxIoExtents];
+    count = std::min(count, kMaxIoExtents);
+    for (size_t i = 0; i < count; ++i) {
+        toIoVec(extents[i], &vecs[i]);
+    }
+#if defined(_WIN32)
+    DWORD nwritten = 0;
+    if (0 != WSASend(fd, vecs, static_cast<DWORD>(count), &nwritten, 0,
+            nullptr, nullptr)) {
+        return -1;
+    }
+    return static_cast<int>(nwritten);
+#else
+    return writev(fd, vecs, static_cast<int>(count));
+#endif
+}
+
+#if defined(HAVE_SENDFILE)
+ssize_t xsendfile(int fd, int in_fd, off_t *offset, size_t nbyte) {
+    return sendfile(fd, in_fd, offset, nbyte);
+}
+#endif
+
+#if defined(HAVE_MSG_ZEROCOPY)
+bool xenableZeroCopy(int fd) {
+    int one = 1;
+    return 0 == setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+}
+
+int xsendZeroCopy(int fd, Extent const *extents, size_t count) {
+    IoVec vecs[kMaxIoExtents];
+    count = std::min(count, kMaxIoExtents);
+    for (size_t i = 0; i < count; ++i) {
+        toIoVec(extents[i], &vecs[i]);
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = vecs;
+    msg.msg_iovlen = count;
+    return sendmsg(fd, &msg, MSG_ZEROCOPY);
+}
+
+int xreadZeroCopyCompletion(int fd, uint32_t *lo, uint32_t *hi) {
+    for (;;) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+                cm = CMSG_NXTHDR(&msg, cm)) {
+            bool recverr = (cm->cmsg_level == SOL_IP
+                    && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6
+                    && cm->cmsg_type == IPV6_RECVERR);
+            if (!recverr) {
+                continue;
+            }
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                *lo = err.ee_info;
+                *hi = err.ee_data;
+                return 1;
+            }
+        }
+        // Not a zero-copy notification; skip it
+    }
+}
+
+bool xreadPending(int fd) {
+    struct pollfd pfd = {};
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0
+        && (pfd.revents & (POLLIN | POLLERR | POLLHUP));
+}
+#endif
+
+#if !defined(_WIN32)
+bool xfileHasRange(int fd, off_t offset, size_t size) {
+    struct stat st;
+    if (offset < 0 || -1 == fstat(fd, &st) || offset > st.st_size) {
+        return false;
+    }
+    // Compared against the remainder, which cannot overflow
+    return size <= static_cast<uint64_t>(st.st_size - offset);
+}
+#endif
+
 int xclose(int fd) {
 #if defined(_WIN32)
     return closesocket(fd);
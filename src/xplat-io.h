@@ -20,7 +20,15 @@
  * SOFTWARE.
  */
 
+#ifndef SRC_XPLAT_IO_H_
+#define SRC_XPLAT_IO_H_
+
+#include <sys/types.h>
+
 #include <cstddef>
+#include <cstdint>
+
+#include "wte/buffer.h"
 
 namespace wte {
 
@@ -30,7 +38,58 @@ int xwrite(int fd, const void *buf, size_t nbyte);
 /** Cross platform wrapper for read(2) from sockets. */
 int xread(int fd, void *buf, size_t nbyte);
 
+/** The most extents consumed by a single `xreadv` or `xwritev`. */
+const size_t kMaxIoExtents = 1024;
+
+/** Cross platform wrapper for readv(2) from sockets, into `count` extents. */
+int xreadv(int fd, Extent const *extents, size_t count);
+
+/** Cross platform wrapper for writev(2) to sockets, from `count` extents. */
+int xwritev(int fd, Extent const *extents, size_t count);
+
+#if defined(HAVE_SENDFILE)
+/**
+ * Wrapper for sendfile(2) from a file to a socket, advancing `offset`.
+ *
+ * @return the bytes sent, 0 at the end of the file, or -1 on error
+ */
+ssize_t xsendfile(int fd, int in_fd, off_t *offset, size_t nbyte);
+#endif
+
+#if defined(HAVE_MSG_ZEROCOPY)
+/** Enable MSG_ZEROCOPY sends on a socket. */
+bool xenableZeroCopy(int fd);
+
+/** Wrapper for sendmsg(2) with MSG_ZEROCOPY, from `count` extents. */
+int xsendZeroCopy(int fd, Extent const *extents, size_t count);
+
+/**
+ * Read a zero-copy completion from the socket error queue.
+ *
+ * @param lo set to the sequence number of the first completed send
+ * @param hi set to the sequence number of the last completed send
+ * @return 1 if a completion was read, 0 if none are queued, or -1 on error
+ */
+int xreadZeroCopyCompletion(int fd, uint32_t *lo, uint32_t *hi);
+
+/**
+ * @return whether a read from the socket would not block, because data,
+ *         EOF, or an error are pending. Consumes nothing.
+ */
+bool xreadPending(int fd);
+#endif
+
+#if !defined(_WIN32)
+/**
+ * @return whether `fd` refers to a file that extends through the region
+ *         of `size` bytes at `offset`
+ */
+bool xfileHasRange(int fd, off_t offset, size_t size);
+#endif
+
 /** Cross platform wrapper for close(2) for sockets. */
 int xclose(int fd);
 
 } // namespace wte
+
+#endif // SRC_XPLAT_IO_H_
@@ -20,10 +20,14 @@
  * SOFTWARE.
  */
 
+#include <stdio.h>
+#include <string.h>
+
 #include <string>
 
 #include <gtest/gtest.h>
 
+#include "buffer_kernels.h"
 #include "wte/buffer.h"
 
 namespace wte {
@@ -148,8 +152,10 @@ TEST(BufferTest, TestPeekSingleExtent) {
 }
 
 TEST(BufferTest, TestPeekMultipleExtents) {
+    // Spliced buffers keep their own extents
     auto buf = mkBuffer("foobar");
-    buf->append("raboof", 6);
+    auto other = mkBuffer("raboof");
+    buf->append(other.get());
     std::vector<Extent> extents;
     buf->peek(9U, &extents);
     ASSERT_EQ(2U, extents.size());
@@ -203,13 +209,300 @@ TEST(BufferTest, TestReserveWithExtents) {
     buf->reserve(10, &extents);
     ASSERT_EQ(1U, extents.size());
     ASSERT_NE(nullptr, extents[0].data);
-    ASSERT_EQ(10U, extents[0].size);
+    ASSERT_LE(10U, extents[0].size);
 
+    // Reservations beyond the tail's space add an extent
+    size_t avail = extents[0].size;
     extents.clear();
-    buf->reserve(15, &extents);
+    buf->reserve(avail + 5, &extents);
     ASSERT_EQ(2U, extents.size());
-    ASSERT_EQ(10U, extents[0].size);
-    ASSERT_EQ(5U, extents[1].size);
+    ASSERT_EQ(avail, extents[0].size);
+    ASSERT_LE(5U, extents[1].size);
+}
+
+TEST(BufferTest, TestReservedSpaceIsNotReadable) {
+    auto buf = mkBuffer("foo");
+    std::vector<Extent> extents;
+    buf->reserve(10, &extents);
+    ASSERT_EQ(3U, buf->size());
+    ASSERT_EQ("foo", contents(*buf));
+
+    // Appends larger than the reservation spill into a new extent
+    buf->append("0123456789abcdef", 16);
+    ASSERT_EQ("foo0123456789abcdef", contents(*buf));
+}
+
+TEST(BufferTest, TestCommit) {
+    auto buf = mkBuffer("foo");
+    std::vector<Extent> extents;
+    buf->reserve(4, &extents);
+    ASSERT_EQ(1U, extents.size());
+    memcpy(extents[0].data, "bar", 3);
+    buf->commit(3);
+    ASSERT_EQ(6U, buf->size());
+    ASSERT_EQ("foobar", contents(*buf));
+
+    // Commits span extents
+    size_t avail = extents[0].size - 3;
+    extents.clear();
+    buf->reserve(avail + 4, &extents);
+    ASSERT_EQ(2U, extents.size());
+    ASSERT_EQ(avail, extents[0].size);
+    memset(extents[0].data, '0', avail);
+    memcpy(extents[1].data, "1234", 4);
+    buf->commit(avail + 4);
+    ASSERT_EQ("foobar" + std::string(avail, '0') + "1234", contents(*buf));
+}
+
+TEST(BufferTest, TestDrainedReservationIsReused) {
+    auto buf = mkBuffer();
+    std::vector<Extent> extents;
+    buf->reserve(16, &extents);
+    char *data = extents[0].data;
+    memcpy(data, "0123456789", 10);
+    buf->commit(10);
+
+    buf->drain(10);
+    ASSERT_TRUE(buf->empty());
+
+    extents.clear();
+    buf->reserve(16, &extents);
+    ASSERT_EQ(1U, extents.size());
+    ASSERT_EQ(data, extents[0].data);
+    ASSERT_LE(16U, extents[0].size);
+}
+
+TEST(BufferTest, TestPartialPrepend) {
+    auto buf = mkBuffer("3456");
+    buf->drain(1);
+    buf->prepend("0123", 4);
+    ASSERT_EQ("0123456", contents(*buf));
+}
+
+TEST(BufferTest, TestClonesShareWithoutAliasing) {
+    auto buf = mkBuffer("0123");
+    buf->append("4567", 4);
+    buf->drain(1);
+
+    auto clone = buf->clone();
+    auto range = buf->cloneRange(2, 4);
+    ASSERT_EQ("1234567", contents(*clone));
+    ASSERT_EQ("3456", contents(*range));
+
+    // Shared storage is neither recycled nor rewritten in place
+    buf->drain(buf->size());
+    buf->append("abcdefgh", 8);
+    buf->prepend("xy", 2);
+    ASSERT_EQ("xyabcdefgh", contents(*buf));
+    ASSERT_EQ("1234567", contents(*clone));
+
+    clone->drain(3);
+    ASSERT_EQ("4567", contents(*clone));
+    ASSERT_EQ("3456", contents(*range));
+
+    // Out of range
+    ASSERT_TRUE(buf->cloneRange(100, 1)->empty());
+}
+
+TEST(BufferTest, TestSplitFront) {
+    auto buf = mkBuffer(std::string(1000, 'a'));
+    auto second = mkBuffer(std::string(1000, 'b'));
+    buf->append(second.get());
+    buf->append("tail", 4);
+
+    // Moves the first extent and shares part of the second
+    auto out = mkBuffer("head");
+    buf->splitFront(1500, out.get());
+    ASSERT_EQ("head" + std::string(1000, 'a') + std::string(500, 'b'),
+        contents(*out));
+    ASSERT_EQ(std::string(500, 'b') + "tail", contents(*buf));
+
+    // Small pieces, and requests beyond the end
+    auto rest = mkBuffer();
+    buf->splitFront(2, rest.get());
+    buf->splitFront(1000, rest.get());
+    ASSERT_TRUE(buf->empty());
+    ASSERT_EQ(std::string(500, 'b') + "tail", contents(*rest));
+}
+
+TEST(BufferTest, TestCursor) {
+    auto buf = mkBuffer("key: va");
+    auto second = mkBuffer("lue\r");
+    buf->append(second.get());
+    buf->append("\nrest", 5);
+
+    auto cursor = buf->cursor();
+    ASSERT_EQ('k', *cursor);
+    ASSERT_TRUE(cursor.find(':'));
+    ASSERT_EQ(3u, cursor.position());
+    ASSERT_EQ(2u, cursor.advance(2));
+    ASSERT_TRUE(cursor.compare("value", 5));
+
+    char out[8];
+    ASSERT_EQ(8u, cursor.copyTo(out, sizeof(out)));
+    ASSERT_EQ("value\r\nr", std::string(out, sizeof(out)));
+
+    // The pattern spans extents
+    ASSERT_TRUE(cursor.find("\r\n", 2));
+    ASSERT_EQ(10u, cursor.position());
+    buf->drain(cursor.position() + 2);
+    ASSERT_EQ("rest", contents(*buf));
+
+    cursor = buf->cursor();
+    ASSERT_FALSE(cursor.find("st!", 3));
+    ASSERT_TRUE(cursor.atEnd());
+    ASSERT_EQ(4u, cursor.position());
+    ASSERT_EQ(0u, cursor.advance(1));
+}
+
+TEST(BufferTest, TestSearchAndChecksumSpanExtents) {
+    std::string data;
+    for (int i = 0; i < 3000; ++i) {
+        data.push_back('a' + i % 23);
+    }
+    data += "needle";
+    auto buf = mkBuffer(data.substr(0, 1000));
+    auto second = mkBuffer(data.substr(1000, 2003));
+    auto third = mkBuffer(data.substr(3003));
+    buf->append(second.get());
+    buf->append(third.get());
+
+    size_t pos = 0;
+    ASSERT_TRUE(buf->find('e', 2990, &pos));
+    ASSERT_EQ(data.find('e', 2990), pos);
+    ASSERT_FALSE(buf->find('z', 0, &pos));
+
+    // The needle straddles the second and third extents
+    ASSERT_TRUE(buf->find("needle", 6, 0, &pos));
+    ASSERT_EQ(3000u, pos);
+    ASSERT_TRUE(buf->find("bcd", 3, 30, &pos));
+    ASSERT_EQ(data.find("bcd", 30), pos);
+    ASSERT_FALSE(buf->find("needles", 7, 0, &pos));
+
+    // Standard check value
+    auto check = mkBuffer("123456789");
+    ASSERT_EQ(0xe3069283u, check->crc32c(0, check->size()));
+
+    for (size_t offset : { 0, 1, 999, 1003 }) {
+        ASSERT_EQ(BufferKernels::Scalar::crc32c(0, data.data() + offset,
+                data.size() - offset),
+            buf->crc32c(offset, data.size()));
+    }
+}
+
+TEST(BufferTest, TestKernelsMatchScalar) {
+    std::string data(300, 'x');
+    for (size_t i = 0; i < data.size(); i += 7) {
+        data[i] = 'a' + i % 5;
+    }
+    for (size_t start = 0; start < 40; ++start) {
+        const char *p = data.data() + start;
+        size_t size = data.size() - start;
+        ASSERT_EQ(BufferKernels::Scalar::findByte(p, size, 'd'),
+            BufferKernels::findByte(p, size, 'd'));
+        ASSERT_EQ(BufferKernels::Scalar::findPattern(p, size, "xxc", 3),
+            BufferKernels::findPattern(p, size, "xxc", 3));
+        ASSERT_EQ(BufferKernels::Scalar::crc32c(7, p, size),
+            BufferKernels::crc32c(7, p, size));
+    }
+    ASSERT_EQ(nullptr, BufferKernels::findPattern(data.data(), data.size(),
+        "xxxxxxxx", 8));
+}
+
+TEST(BufferTest, TestPullup) {
+    auto buf = mkBuffer("head");
+    auto second = mkBuffer("er:");
+    auto third = mkBuffer("body");
+    buf->append(second.get());
+    buf->append(third.get());
+
+    // Contiguous prefixes are returned in place
+    std::vector<Extent> extents;
+    buf->peek(4, &extents);
+    ASSERT_EQ(extents[0].data, buf->pullup(3));
+
+    // Fills the first extent from the next ones
+    const char *header = buf->pullup(8);
+    ASSERT_EQ(extents[0].data, header);
+    ASSERT_EQ("header:b", std::string(header, 8));
+    ASSERT_EQ("header:body", contents(*buf));
+    ASSERT_EQ(nullptr, buf->pullup(12));
+
+    // Shared extents are not rewritten
+    auto clone = buf->cloneRange(0, buf->size());
+    const char *all = clone->pullup(clone->size());
+    ASSERT_NE(nullptr, all);
+    ASSERT_EQ("header:body", std::string(all, clone->size()));
+    ASSERT_EQ("header:body", contents(*buf));
+}
+
+TEST(BufferTest, TestExternalMemory) {
+    const std::string external = "external data";
+    int released = 0;
+    auto buf = mkBuffer("head ");
+    buf->appendExternal(external.data(), external.size(),
+        [&released]() { ++released; });
+    buf->append("tail", 4);
+    ASSERT_EQ("head external datatail", contents(*buf));
+
+    std::vector<Extent> extents;
+    buf->peek(buf->size(), &extents);
+    ASSERT_EQ(external.data(), extents[1].data);
+
+    // Neither prepends nor the clone write to the external memory
+    buf->drain(9);
+    buf->prepend("in", 2);
+    auto clone = buf->cloneRange(2, 4);
+    buf->drain(buf->size());
+    ASSERT_EQ("external data", external);
+    ASSERT_EQ(0, released);
+
+    ASSERT_EQ("rnal", contents(*clone));
+    clone.reset();
+    ASSERT_EQ(1, released);
+}
+
+TEST(BufferTest, TestFileExtents) {
+    std::string data;
+    for (int i = 0; i < 10000; ++i) {
+        data.push_back('a' + i % 26);
+    }
+    FILE *file = tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), file));
+    fflush(file);
+
+    // The offset need not be page aligned
+    auto buf = mkBuffer("head");
+    buf->appendFile(fileno(file), 5000, 3000);
+    ASSERT_EQ("head" + data.substr(5000, 3000), contents(*buf));
+    buf->drain(buf->size());
+
+    // Regions must lie within the file
+    ASSERT_THROW(buf->appendFile(fileno(file), 5000, 5001),
+        std::runtime_error);
+    ASSERT_THROW(buf->appendFile(fileno(file), -1, 10), std::runtime_error);
+    ASSERT_THROW(buf->appendFile(fileno(file), 10, SIZE_MAX),
+        std::runtime_error);
+    ASSERT_EQ(0U, buf->size());
+    fclose(file);
+
+    ASSERT_THROW(buf->appendFile(-1, 0, 10), std::runtime_error);
+}
+
+TEST(BufferTest, TestSmallAppendsCoalesce) {
+    auto buf = mkBuffer();
+    std::string expected;
+    for (int i = 0; i < 100; ++i) {
+        std::string chunk(20, static_cast<char>('a' + i % 26));
+        buf->append(chunk.data(), chunk.size());
+        expected += chunk;
+    }
+    ASSERT_EQ(expected, contents(*buf));
+
+    std::vector<Extent> extents;
+    buf->peek(buf->size(), &extents);
+    ASSERT_GE(5U, extents.size());
 }
 
 } // wte namespace
@@ -20,20 +20,34 @@
  * SOFTWARE.
  */
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#endif
+
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
 #include "event_base_test.h"
 #include "test_util.h"
 #include "wte/connection_listener.h"
+#include "wte/event_base_pool.h"
+#include "wte/event_handler.h"
 
 namespace wte {
 
 class ConnectionListenerTest : public EventBaseTest {
 public:
     ConnectionListenerTest() : accept_count_(0), error_count_(0) { }
+    explicit ConnectionListenerTest(EventBaseOptions const& options)
+        : EventBaseTest(options), accept_count_(0), error_count_(0) { }
     ~ConnectionListenerTest() { }
 
 protected:
@@ -58,6 +72,61 @@ protected:
         ++error_count_;
     }
 
+    // Records the number of accepted connections each time it is ready
+    class ObservingHandler final : public EventHandler {
+    public:
+        ObservingHandler(int fd, std::atomic<int> *accepted)
+            : EventHandler(fd), accepted(accepted) { }
+        void ready(What) NOEXCEPT override {
+            char c;
+            while (xread(fd(), &c, 1) == 1) { }
+            observed.push_back(*accepted);
+        }
+        std::atomic<int> *accepted;
+        std::vector<int> observed;
+    };
+
+    // Accept a backlog of 8 connections in batches of 3, checking that
+    // each loop iteration accepts one batch and that a handler ready in
+    // every iteration runs between them
+    void acceptInBoundedBatches() {
+        auto listener = mkListener(base, [this](int fd) {
+                xclose(fd);
+                ++accept_count_;
+            }, mkError());
+        listener->setAcceptBatchLimit(3);
+        listener->bind(0);
+        listener->listen(128);
+        listener->startAccepting();
+
+        for (int i = 0; i < 8; ++i) {
+            xclose(connectOrThrow(listener.get()));
+        }
+
+        ObservingHandler other(fds[0], &accept_count_);
+        base->registerHandler(&other, What::READ);
+
+        const int expected[] = { 3, 6, 8 };
+        for (int batch : expected) {
+            ASSERT_EQ(1, xwrite(fds[1], "x", 1));
+            base->loop(EventBase::LoopMode::ONCE);
+            ASSERT_EQ(batch, accept_count_);
+        }
+
+        // Depending on dispatch order, the handler ran either before or
+        // after the batch in its iteration; either way, while part of the
+        // backlog was still pending
+        ASSERT_EQ(3U, other.observed.size());
+        for (size_t i = 0; i < other.observed.size(); ++i) {
+            int before = i == 0 ? 0 : expected[i - 1];
+            ASSERT_TRUE(other.observed[i] == before ||
+                other.observed[i] == expected[i]);
+        }
+        base->unregisterHandler(&other);
+        listener->stopAccepting();
+        ASSERT_EQ(0, error_count_);
+    }
+
     std::atomic<int> accept_count_;
     std::atomic<int> error_count_;
 };
@@ -89,4 +158,141 @@ TEST_F(ConnectionListenerTest, BindToBadIpThrows) {
     ASSERT_THROW({ listener->bind("not.an.ip", 0); }, std::runtime_error);
 }
 
+TEST_F(ConnectionListenerTest, BatchCallbackReceivesPendingConnections) {
+    std::vector<AcceptedConnection> accepted;
+    auto listener = mkBatchConnectionListener(base,
+        [&accepted](std::vector<AcceptedConnection>& batch) {
+            accepted.insert(accepted.end(), batch.begin(), batch.end());
+        }, mkError());
+    listener->bind(0);
+    listener->listen(128);
+    listener->startAccepting();
+
+    std::vector<int> clients;
+    for (int i = 0; i < 8; ++i) {
+        clients.push_back(connectOrThrow(listener.get()));
+    }
+
+    base->loop(EventBase::LoopMode::ONCE);
+
+    ASSERT_EQ(8U, accepted.size());
+    for (auto& conn : accepted) {
+        ASSERT_EQ(AF_INET, conn.peer.ss_family);
+#if !defined(_WIN32)
+        ASSERT_TRUE(fcntl(conn.fd, F_GETFL) & O_NONBLOCK);
+        ASSERT_TRUE(fcntl(conn.fd, F_GETFD) & FD_CLOEXEC);
+#endif
+        xclose(conn.fd);
+    }
+    for (int fd : clients) {
+        xclose(fd);
+    }
+    ASSERT_EQ(0, error_count_);
+}
+
+TEST_F(ConnectionListenerTest, BatchLimitDefersRemainingConnections) {
+    acceptInBoundedBatches();
+}
+
+#if defined(HAVE_EPOLL)
+namespace {
+EventBaseOptions edgeTriggeredOptions() {
+    EventBaseOptions options;
+    options.backend = Backend::EPOLL;
+    options.edgeTriggered = true;
+    return options;
+}
+} // unnamed namespace
+
+class EdgeTriggeredConnectionListenerTest : public ConnectionListenerTest {
+public:
+    EdgeTriggeredConnectionListenerTest()
+        : ConnectionListenerTest(edgeTriggeredOptions()) { }
+};
+
+TEST_F(EdgeTriggeredConnectionListenerTest,
+        BatchLimitDefersRemainingConnections) {
+    acceptInBoundedBatches();
+}
+#endif
+
+#if defined(__linux__)
+class ShardedConnectionListenerTest : public ::testing::Test {
+protected:
+    std::shared_ptr<ConnectionListener> mkListener(
+            std::shared_ptr<EventBasePool> pool,
+            ShardedListenerOptions const& options) {
+        return mkShardedConnectionListener(pool,
+            [this](std::shared_ptr<EventBase> base, int fd) {
+                xclose(fd);
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++accepts_[base.get()];
+                ++total_;
+            },
+            [](std::exception const&) { }, options);
+    }
+
+    // Connect `count` clients and wait for the listener to accept them
+    void connectAndAwait(ConnectionListener *listener, int count) {
+        for (int i = 0; i < count; ++i) {
+            xclose(connectOrThrow(listener));
+        }
+        for (int i = 0; i < 5000; ++i) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (total_ == count) {
+                    return;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::mutex mutex_;
+    std::map<EventBase*, int> accepts_;
+    int total_ = 0;
+};
+
+TEST_F(ShardedConnectionListenerTest, EachLoopAcceptsConnections) {
+    EventBasePoolOptions poolOptions;
+    poolOptions.size = 2;
+    auto pool = mkEventBasePool(poolOptions);
+
+    auto listener = mkListener(pool, ShardedListenerOptions());
+    listener->bind(0);
+    ASSERT_GT(listener->port(), 0U);
+    listener->listen(128);
+    listener->startAccepting();
+
+    connectAndAwait(listener.get(), 64);
+    listener->stopAccepting();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ASSERT_EQ(64, total_);
+    // Connections are hashed across both shards
+    ASSERT_EQ(2U, accepts_.size());
+    ASSERT_EQ(1U, accepts_.count(pool->get(0).get()));
+    ASSERT_EQ(1U, accepts_.count(pool->get(1).get()));
+}
+
+TEST_F(ShardedConnectionListenerTest, CpuSteeringAcceptsConnections) {
+    EventBasePoolOptions poolOptions;
+    poolOptions.size = 2;
+    poolOptions.pinThreads = true;
+    auto pool = mkEventBasePool(poolOptions);
+
+    ShardedListenerOptions options;
+    options.steerByCpu = true;
+    auto listener = mkListener(pool, options);
+    listener->bind(0);
+    listener->listen(128);
+    listener->startAccepting();
+
+    connectAndAwait(listener.get(), 16);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ASSERT_EQ(16, total_);
+}
+#endif
+
 } // wte namespace
@@ -0,0 +1,258 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if defined(HAVE_EPOLL)
+
+#include <chrono>
+#include <thread>
+
+#include "event_base_test.h"
+#include "wte/event_base.h"
+#include "wte/event_handler.h"
+#include "wte/stream.h"
+#include "wte/timeout.h"
+#include "xplat-io.h"
+
+namespace wte {
+
+namespace {
+EventBaseOptions epollOptions(bool edgeTriggered) {
+    EventBaseOptions options;
+    options.backend = Backend::EPOLL;
+    options.edgeTriggered = edgeTriggered;
+    return options;
+}
+} // unnamed namespace
+
+class EpollEventBaseTest : public EventBaseTest {
+public:
+    explicit EpollEventBaseTest(bool edgeTriggered = false)
+        : EventBaseTest(epollOptions(edgeTriggered)) { }
+
+    class CountingHandler final : public EventHandler {
+    public:
+        explicit CountingHandler(int fd) : EventHandler(fd) { }
+        void ready(What event) NOEXCEPT override {
+            last_event = event;
+            ++count;
+        }
+        What last_event = What::NONE;
+        int count = 0;
+    };
+
+    class TestTimeout final : public Timeout {
+    public:
+        void expired() NOEXCEPT {
+            ++count;
+        }
+        int count = 0;
+    };
+};
+
+class EdgeTriggeredEpollEventBaseTest : public EpollEventBaseTest {
+public:
+    EdgeTriggeredEpollEventBaseTest()
+        : EpollEventBaseTest(/*edgeTriggered=*/ true) { }
+};
+
+TEST_F(EpollEventBaseTest, StopTerminatesLoop) {
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::FOREVER); });
+    ASSERT_TRUE(loop.joinable());
+    base->stop();
+    loop.join();
+}
+
+TEST_F(EpollEventBaseTest, RegistrationStateChanges) {
+    CountingHandler handler(fds[0]);
+    ASSERT_FALSE(handler.registered());
+
+    base->registerHandler(&handler, What::READ);
+    ASSERT_TRUE(handler.registered());
+    ASSERT_EQ(What::READ, handler.watched());
+
+    // Interest changes are applied in place
+    base->registerHandler(&handler, What::READ_WRITE);
+    ASSERT_EQ(What::READ_WRITE, handler.watched());
+
+    base->unregisterHandler(&handler);
+    ASSERT_FALSE(handler.registered());
+    ASSERT_EQ(What::NONE, handler.watched());
+
+    // Idempotence
+    base->unregisterHandler(&handler);
+    ASSERT_FALSE(handler.registered());
+
+    // Re-registration after unregistration
+    base->registerHandler(&handler, What::WRITE);
+    ASSERT_EQ(What::WRITE, handler.watched());
+    base->unregisterHandler(&handler);
+}
+
+TEST_F(EpollEventBaseTest, DispatchesOnlyWatchedEvents) {
+    CountingHandler handler(fds[0]);
+    base->registerHandler(&handler, What::READ_WRITE);
+
+    // Writable, but nothing to read
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(What::WRITE, handler.last_event);
+
+    ASSERT_EQ(1, xwrite(fds[1], "x", 1));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(What::READ_WRITE, handler.last_event);
+
+    base->registerHandler(&handler, What::READ);
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(What::READ, handler.last_event);
+
+    base->unregisterHandler(&handler);
+}
+
+TEST_F(EpollEventBaseTest, LoopExitsWhenEmpty) {
+    class SelfUnregistering final : public EventHandler {
+    public:
+        explicit SelfUnregistering(int fd) : EventHandler(fd) { }
+        void ready(What) NOEXCEPT override {
+            base()->unregisterHandler(this);
+        }
+    };
+
+    SelfUnregistering handler(fds[0]);
+    base->registerHandler(&handler, What::WRITE);
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_FALSE(handler.registered());
+}
+
+TEST_F(EpollEventBaseTest, TimeoutsFireOnce) {
+    struct timeval tv { 0, 1000 };
+    TestTimeout timeout;
+    base->registerTimeout(&timeout, &tv);
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_EQ(1, timeout.count);
+}
+
+TEST_F(EpollEventBaseTest, UnregisteredTimeoutsDoNotFire) {
+    struct timeval tv { 0, 1000 };
+    TestTimeout timeout;
+    base->registerTimeout(&timeout, &tv);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    base->unregisterTimeout(&timeout);
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_EQ(0, timeout.count);
+}
+
+TEST_F(EpollEventBaseTest, RunOnEventLoopFromOtherThread) {
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::FOREVER); });
+    int value = 0;
+    ASSERT_TRUE(base->runOnEventLoopAndWait([&value]() { value = 1; },
+        /*defer=*/ true));
+    ASSERT_EQ(1, value);
+    base->stop();
+    loop.join();
+}
+
+TEST_F(EpollEventBaseTest, SpinDispatchesHandlersAndTimeouts) {
+    CountingHandler handler(fds[0]);
+    base->registerHandler(&handler, What::READ);
+    struct timeval tv { 0, 1000 };
+    TestTimeout timeout;
+    base->registerTimeout(&timeout, &tv);
+
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::SPIN); });
+    ASSERT_EQ(1, xwrite(fds[1], "x", 1));
+
+    bool done = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done && std::chrono::steady_clock::now() < deadline) {
+        base->runOnEventLoopAndWait([&]() {
+                done = handler.count > 0 && timeout.count == 1;
+            }, /*defer=*/ true);
+    }
+    ASSERT_TRUE(done);
+
+    base->stop();
+    loop.join();
+    base->unregisterHandler(&handler);
+}
+
+TEST_F(EdgeTriggeredEpollEventBaseTest, ReadinessIsReportedOncePerEdge) {
+    CountingHandler handler(fds[0]);
+    base->registerHandler(&handler, What::READ);
+
+    ASSERT_EQ(1, xwrite(fds[1], "x", 1));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(1, handler.count);
+
+    // The unread byte does not trigger another notification...
+    struct timeval tv { 0, 1000 };
+    TestTimeout timeout;
+    base->registerTimeout(&timeout, &tv);
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(1, handler.count);
+
+    // ...but new data does
+    ASSERT_EQ(1, xwrite(fds[1], "x", 1));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(2, handler.count);
+
+    base->unregisterHandler(&handler);
+}
+
+TEST_F(EdgeTriggeredEpollEventBaseTest, StreamRoundTrip) {
+    class Writer final : public Stream::WriteCallback {
+    public:
+        void complete(Stream *) override { completed = true; }
+        void error(std::runtime_error const&) override { }
+        bool completed = false;
+    };
+
+    class Reader final : public Stream::ReadCallback {
+    public:
+        void available(Buffer *buf) override {
+            total += buf->size();
+            buf->drain(buf->size());
+        }
+        void eof() override { }
+        void error(std::runtime_error const&) override { }
+        size_t total = 0;
+    };
+
+    Writer wcb;
+    Reader rcb;
+    auto wstream = wrapFd(base, fds[0]);
+    auto rstream = wrapFd(base, fds[1]);
+
+    const size_t kSize = 1 << 20;
+    std::unique_ptr<char[]> data(new char[kSize]);
+    memset(data.get(), 'A', kSize);
+    wstream->write(data.get(), kSize, &wcb);
+    rstream->startRead(&rcb);
+
+    while (rcb.total < kSize) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    ASSERT_TRUE(wcb.completed);
+    rstream->stopRead();
+}
+
+} // wte namespace
+
+#endif // HAVE_EPOLL
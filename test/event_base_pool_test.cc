@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "wte/event_base_pool.h"
+
+namespace wte {
+
+namespace {
+EventBasePoolOptions poolOptions(size_t size) {
+    EventBasePoolOptions options;
+    options.size = size;
+    return options;
+}
+} // unnamed namespace
+
+TEST(EventBasePoolTest, DefaultSizeIsNonEmpty) {
+    auto pool = mkEventBasePool();
+    ASSERT_LT(0U, pool->size());
+}
+
+TEST(EventBasePoolTest, NextIsRoundRobin) {
+    auto pool = mkEventBasePool(poolOptions(3));
+    ASSERT_EQ(3U, pool->size());
+
+    std::set<EventBase*> seen;
+    for (size_t i = 0; i < pool->size(); ++i) {
+        seen.insert(pool->next().get());
+    }
+    ASSERT_EQ(3U, seen.size());
+    ASSERT_EQ(pool->next(), pool->get(0));
+}
+
+TEST(EventBasePoolTest, LoopsRunOnDistinctThreads) {
+    auto pool = mkEventBasePool(poolOptions(4));
+
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    for (size_t i = 0; i < pool->size(); ++i) {
+        ASSERT_TRUE(pool->get(i)->runOnEventLoopAndWait([&]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.insert(std::this_thread::get_id());
+            }, /*defer=*/ false));
+    }
+    ASSERT_EQ(4U, threads.size());
+    ASSERT_EQ(0U, threads.count(std::this_thread::get_id()));
+}
+
+TEST(EventBasePoolTest, LeastLoadedBalancesAssignments) {
+    auto pool = mkEventBasePool(poolOptions(2));
+
+    auto a = pool->leastLoaded();
+    auto b = pool->leastLoaded();
+    ASSERT_NE(a, b);
+
+    // Releasing an assignment makes its base preferred again
+    pool->release(a.get());
+    ASSERT_EQ(a, pool->leastLoaded());
+    pool->release(b.get());
+    ASSERT_EQ(b, pool->leastLoaded());
+}
+
+TEST(EventBasePoolTest, StopIsIdempotent) {
+    auto pool = mkEventBasePool(poolOptions(2));
+    pool->stop();
+    pool->stop();
+}
+
+#if defined(__linux__)
+TEST(EventBasePoolTest, PinnedThreadsRunOnOneProcessor) {
+    EventBasePoolOptions options = poolOptions(2);
+    options.pinThreads = true;
+    auto pool = mkEventBasePool(options);
+
+    for (size_t i = 0; i < pool->size(); ++i) {
+        int count = 0;
+        pool->get(i)->runOnEventLoopAndWait([&count]() {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                sched_getaffinity(0, sizeof(set), &set);
+                count = CPU_COUNT(&set);
+            }, /*defer=*/ false);
+        ASSERT_EQ(1, count);
+    }
+}
+#endif
+
+} // wte namespace
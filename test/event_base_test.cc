@@ -20,8 +20,11 @@
  * SOFTWARE.
  */
 
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #define NOMINMAX
 
@@ -120,4 +123,84 @@ TEST_F(EventBaseTest, LoopExitsWhenEmpty) {
     ASSERT_EQ(0, handler.limit_);
 }
 
+TEST_F(EventBaseTest, ConcurrentPostsAllRun) {
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::FOREVER); });
+
+    const int kProducers = 4;
+    const int kPerProducer = 10000;
+    std::atomic<int> count(0);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([this, &count]() {
+            for (int i = 0; i < kPerProducer; ++i) {
+                base->runOnEventLoop([&count]() { ++count; }, /*defer=*/ true);
+            }
+        });
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+
+    // No post may be stranded in the queue without a wakeup
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (count.load() < kProducers * kPerProducer &&
+            std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(kProducers * kPerProducer, count.load());
+
+    base->stop();
+    loop.join();
+}
+
+class SpinningEventBaseTest : public EventBaseTest {
+public:
+    SpinningEventBaseTest() : EventBaseTest(spinOptions()) { }
+
+    static EventBaseOptions spinOptions() {
+        EventBaseOptions options;
+        options.spinIdleMicros = 100;
+        return options;
+    }
+};
+
+TEST_F(SpinningEventBaseTest, DispatchesWhileSpinningAndAfterBackoff) {
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::SPIN); });
+
+    int value = 0;
+    ASSERT_TRUE(base->runOnEventLoopAndWait([&value]() { ++value; },
+        /*defer=*/ true));
+
+    // Long enough to back off to blocking; the post must still wake it
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_TRUE(base->runOnEventLoopAndWait([&value]() { ++value; },
+        /*defer=*/ true));
+    ASSERT_EQ(2, value);
+
+    base->stop();
+    loop.join();
+}
+
+TEST(BoundedNotifyQueueTest, PostsFailWhenFull) {
+    EventBaseOptions options;
+    options.notifyQueueCapacity = 4;
+    auto base = mkEventBase(options);
+
+    int count = 0;
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(base->runOnEventLoop([&count]() { ++count; },
+            /*defer=*/ true));
+    }
+    ASSERT_FALSE(base->runOnEventLoop([&count]() { ++count; },
+        /*defer=*/ true));
+
+    // Draining the queue relieves the back-pressure
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(4, count);
+    ASSERT_TRUE(base->runOnEventLoop([&count]() { ++count; },
+        /*defer=*/ true));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(5, count);
+}
+
 } // wte namespace
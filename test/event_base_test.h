@@ -33,7 +33,10 @@ namespace wte {
 
 class EventBaseTest : public ::testing::Test {
 public:
-    EventBaseTest() : base(mkEventBase()) {
+    EventBaseTest() : EventBaseTest(EventBaseOptions()) { }
+
+    explicit EventBaseTest(EventBaseOptions const& options)
+            : base(mkEventBase(options)) {
 #if defined(_WIN32)
         int rc = evutil_socketpair(AF_INET, SOCK_STREAM, 0, fds);
 #else
@@ -0,0 +1,342 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if defined(HAVE_IO_URING)
+
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "event_base_test.h"
+#include "io_uring.h"
+#include "wte/connection_listener.h"
+#include "wte/event_base.h"
+#include "wte/event_handler.h"
+#include "wte/stream.h"
+#include "wte/timeout.h"
+#include "xplat-io.h"
+
+namespace wte {
+
+class IoUringEventBaseTest : public EventBaseTest {
+public:
+    IoUringEventBaseTest() {
+        // io_uring may be unavailable at runtime (old kernels, sandboxes);
+        // tests pass vacuously in that case
+        EventBaseOptions options;
+        options.backend = Backend::IO_URING;
+        try {
+            base = mkEventBase(options);
+            supported = true;
+        } catch (std::runtime_error const&) { }
+    }
+
+    class CountingHandler final : public EventHandler {
+    public:
+        explicit CountingHandler(int fd) : EventHandler(fd) { }
+        void ready(What event) NOEXCEPT override {
+            last_event = event;
+            ++count;
+        }
+        What last_event = What::NONE;
+        int count = 0;
+    };
+
+    class TestTimeout final : public Timeout {
+    public:
+        void expired() NOEXCEPT {
+            ++count;
+        }
+        int count = 0;
+    };
+
+    class Writer final : public Stream::WriteCallback {
+    public:
+        void complete(Stream *) override { ++completed; }
+        void error(std::runtime_error const&) override { errored = true; }
+        int completed = 0;
+        bool errored = false;
+    };
+
+    class Reader final : public Stream::ReadCallback {
+    public:
+        void available(Buffer *buf) override {
+            size_t size = buf->size();
+            std::unique_ptr<char[]> tmp(new char[size]);
+            size_t nread = 0;
+            buf->read(tmp.get(), size, &nread);
+            data.append(tmp.get(), nread);
+        }
+        void eof() override { hit_eof = true; }
+        void error(std::runtime_error const&) override { errored = true; }
+        std::string data;
+        bool hit_eof = false;
+        bool errored = false;
+    };
+
+    bool supported = false;
+};
+
+TEST_F(IoUringEventBaseTest, StopTerminatesLoop) {
+    if (!supported) {
+        return;
+    }
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::FOREVER); });
+    ASSERT_TRUE(loop.joinable());
+    base->stop();
+    loop.join();
+}
+
+TEST_F(IoUringEventBaseTest, HandlersAreLevelTriggered) {
+    if (!supported) {
+        return;
+    }
+    CountingHandler handler(fds[0]);
+    base->registerHandler(&handler, What::READ_WRITE);
+
+    // Writable, but nothing to read
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(What::WRITE, handler.last_event);
+
+    ASSERT_EQ(1, xwrite(fds[1], "x", 1));
+    base->registerHandler(&handler, What::READ);
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(What::READ, handler.last_event);
+
+    // The unread byte is reported again
+    int count = handler.count;
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(count + 1, handler.count);
+
+    base->unregisterHandler(&handler);
+    ASSERT_FALSE(handler.registered());
+}
+
+TEST_F(IoUringEventBaseTest, FailedPollsAreNotRearmed) {
+    if (!supported) {
+        return;
+    }
+    int fd = dup(fds[0]);
+    ASSERT_NE(-1, fd);
+    CountingHandler handler(fd);
+    base->registerHandler(&handler, What::READ);
+
+    // Closed before the poll is submitted, which then fails
+    xclose(fd);
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(1, handler.count);
+    ASSERT_EQ(What::READ, handler.last_event);
+    ASSERT_FALSE(handler.registered());
+
+    // Nothing is left to poll
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(1, handler.count);
+}
+
+TEST_F(IoUringEventBaseTest, LoopExitsWhenEmpty) {
+    if (!supported) {
+        return;
+    }
+    class SelfUnregistering final : public EventHandler {
+    public:
+        explicit SelfUnregistering(int fd) : EventHandler(fd) { }
+        void ready(What) NOEXCEPT override {
+            base()->unregisterHandler(this);
+        }
+    };
+
+    SelfUnregistering handler(fds[0]);
+    base->registerHandler(&handler, What::WRITE);
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_FALSE(handler.registered());
+}
+
+TEST_F(IoUringEventBaseTest, TimeoutsFireOnce) {
+    if (!supported) {
+        return;
+    }
+    struct timeval tv { 0, 1000 };
+    TestTimeout timeout;
+    base->registerTimeout(&timeout, &tv);
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_EQ(1, timeout.count);
+}
+
+TEST_F(IoUringEventBaseTest, RunOnEventLoopFromOtherThread) {
+    if (!supported) {
+        return;
+    }
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::FOREVER); });
+    int value = 0;
+    ASSERT_TRUE(base->runOnEventLoopAndWait([&value]() { value = 1; },
+        /*defer=*/ true));
+    ASSERT_EQ(1, value);
+    base->stop();
+    loop.join();
+}
+
+TEST_F(IoUringEventBaseTest, SpinDispatchesHandlersAndTimeouts) {
+    if (!supported) {
+        return;
+    }
+    CountingHandler handler(fds[0]);
+    base->registerHandler(&handler, What::READ);
+    struct timeval tv { 0, 1000 };
+    TestTimeout timeout;
+    base->registerTimeout(&timeout, &tv);
+
+    std::thread loop([this]() { base->loop(EventBase::LoopMode::SPIN); });
+    ASSERT_EQ(1, xwrite(fds[1], "x", 1));
+
+    bool done = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done && std::chrono::steady_clock::now() < deadline) {
+        base->runOnEventLoopAndWait([&]() {
+                done = handler.count > 0 && timeout.count == 1;
+            }, /*defer=*/ true);
+    }
+    ASSERT_TRUE(done);
+
+    base->stop();
+    loop.join();
+    base->unregisterHandler(&handler);
+}
+
+TEST_F(IoUringEventBaseTest, StreamWritesArriveInOrder) {
+    if (!supported) {
+        return;
+    }
+    Writer wcb;
+    Reader rcb;
+    auto wstream = wrapFd(base, fds[0]);
+    auto rstream = wrapFd(base, fds[1]);
+
+    std::string expected;
+    for (int i = 0; i < 100; ++i) {
+        std::string chunk(1 + i * 997, 'a' + i % 26);
+        expected += chunk;
+        wstream->write(chunk.data(), chunk.size(), &wcb);
+    }
+    rstream->startRead(&rcb);
+
+    while (rcb.data.size() < expected.size()) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    ASSERT_EQ(100, wcb.completed);
+    ASSERT_EQ(expected, rcb.data);
+
+    wstream->close();
+    while (!rcb.hit_eof) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    rstream->stopRead();
+    fds[0] = -1;
+}
+
+TEST_F(IoUringEventBaseTest, DestroyingStreamCancelsOperations) {
+    if (!supported) {
+        return;
+    }
+    Reader rcb;
+    {
+        auto stream = wrapFd(base, fds[0]);
+        stream->startRead(&rcb);
+        base->runOnEventLoop([]() { }, /*defer=*/ true);
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+
+    // The cancelled receive drains without reaching the callback
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_TRUE(rcb.data.empty());
+    ASSERT_FALSE(rcb.errored);
+}
+
+TEST_F(IoUringEventBaseTest, ConnectWriteRead) {
+    if (!supported) {
+        return;
+    }
+    class Connect final : public Stream::ConnectCallback {
+    public:
+        void complete() override { completed = true; }
+        void error(std::runtime_error const&) override { errored = true; }
+        bool completed = false;
+        bool errored = false;
+    };
+
+    Reader server_rcb;
+    std::unique_ptr<Stream, Stream::Deleter> accepted;
+    auto listener = mkConnectionListener(base, [&](int fd) {
+            accepted = wrapFd(base, fd);
+            accepted->startRead(&server_rcb);
+        }, [](std::exception const&) { });
+    listener->bind(0);
+    listener->listen(1);
+    listener->startAccepting();
+
+    Connect ccb;
+    Writer wcb;
+    auto stream = Stream::create(base);
+    stream->connect("127.0.0.1", listener->port(), &ccb);
+    while (!ccb.completed && !ccb.errored) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    ASSERT_TRUE(ccb.completed);
+
+    stream->write("hello", 5, &wcb);
+    while (server_rcb.data.size() < 5) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    ASSERT_EQ("hello", server_rcb.data);
+    ASSERT_EQ(1, wcb.completed);
+
+    listener->stopAccepting();
+}
+
+TEST_F(IoUringEventBaseTest, SubmissionsOutpaceCompletionRing) {
+    if (!supported) {
+        return;
+    }
+
+    // Far more operations than either ring holds, without reaping
+    IoUring ring(2);
+    const uint64_t kOps = 256;
+    for (uint64_t i = 1; i <= kOps; ++i) {
+        ring.next(i)->opcode = IORING_OP_NOP;
+    }
+    ring.enter(/*wait=*/ false, -1);
+
+    // Completions are reaped once each, in submission order
+    uint64_t expected = 1;
+    while (expected <= kOps) {
+        ring.enter(/*wait=*/ true, 1000);
+        ring.reap([&expected](uint64_t data, int result) {
+                EXPECT_EQ(expected, data);
+                EXPECT_EQ(0, result);
+                ++expected;
+            });
+    }
+}
+
+} // wte namespace
+
+#endif // HAVE_IO_URING
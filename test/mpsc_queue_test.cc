@@ -22,6 +22,9 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 #include "mpsc_queue.h"
 
 namespace wte {
@@ -42,4 +45,62 @@ TEST(ConcurrentMPSCQueueTest, Basic) {
     ASSERT_FALSE(queue.pop());
 }
 
+TEST(BoundedMPSCQueueTest, Basic) {
+    BoundedMPSCQueue<int> queue(3);
+    ASSERT_EQ(4u, queue.capacity());
+
+    ASSERT_EQ(PushResult::EMPTY, queue.push(1));
+    ASSERT_EQ(PushResult::NONEMPTY, queue.push(2));
+    ASSERT_EQ(PushResult::NONEMPTY, queue.push(3));
+    ASSERT_EQ(PushResult::NONEMPTY, queue.push(4));
+    ASSERT_EQ(PushResult::FULL, queue.push(5));
+
+    ASSERT_EQ(1, queue.pop().value());
+    ASSERT_EQ(2, queue.pop().value());
+
+    // Wraps around
+    ASSERT_EQ(PushResult::NONEMPTY, queue.push(5));
+    for (int i = 3; i <= 5; ++i) {
+        ASSERT_EQ(i, queue.pop().value());
+    }
+    ASSERT_FALSE(queue.pop());
+    ASSERT_EQ(PushResult::EMPTY, queue.push(6));
+}
+
+TEST(BoundedMPSCQueueTest, ConcurrentProducers) {
+    const int kProducers = 4;
+    const int kPerProducer = 10000;
+    BoundedMPSCQueue<int> queue(64);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&queue, p]() {
+            for (int i = 0; i < kPerProducer; ++i) {
+                while (queue.push(p * kPerProducer + i) == PushResult::FULL) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Elements from each producer arrive in order
+    std::vector<int> next(kProducers, 0);
+    for (int received = 0; received < kProducers * kPerProducer; ) {
+        auto value = queue.pop();
+        if (!value) {
+            std::this_thread::yield();
+            continue;
+        }
+        int p = value.value() / kPerProducer;
+        ASSERT_EQ(next[p], value.value() % kPerProducer);
+        ++next[p];
+        ++received;
+    }
+
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    ASSERT_FALSE(queue.pop());
+}
+
 } // wte namespace
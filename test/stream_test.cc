@@ -20,10 +20,20 @@
  * SOFTWARE.
  */
 
+#include <stdio.h>
+#include <string.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include <chrono>
 #include <memory>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "event_base_test.h"
+#include "notifying_event_base.h"
 #include "wte/connection_listener.h"
 #include "wte/stream.h"
 #include "wte/timeout.h"
@@ -143,6 +153,10 @@ void EchoServer::ReadCallback::error(std::runtime_error const&) {
 
 class StreamTest : public EventBaseTest {
 public:
+    StreamTest() { }
+    explicit StreamTest(EventBaseOptions const& options)
+        : EventBaseTest(options) { }
+
     class TestWriteCallback final : public Stream::WriteCallback {
     public:
         void complete(Stream *) override {
@@ -187,8 +201,124 @@ public:
         bool completed = false;
         bool errored = false;
     };
+
+#if defined(HAVE_MSG_ZEROCOPY)
+    // Checks that input arriving at a write-only stream while a zero-copy
+    // send is pinned is delivered once the stream starts reading
+    void expectInputSurvivesPinnedSend();
+#endif
 };
 
+#if defined(HAVE_EPOLL)
+namespace {
+EventBaseOptions edgeTriggeredOptions() {
+    EventBaseOptions options;
+    options.backend = Backend::EPOLL;
+    options.edgeTriggered = true;
+    return options;
+}
+} // unnamed namespace
+
+class EdgeTriggeredStreamTest : public StreamTest {
+public:
+    EdgeTriggeredStreamTest() : StreamTest(edgeTriggeredOptions()) { }
+};
+#endif
+
+// Records the order in which writes complete
+class OrderedWriteCallback final : public Stream::WriteCallback {
+public:
+    OrderedWriteCallback(std::vector<int> *order, int index)
+        : order(order), index(index) { }
+    void complete(Stream *) override { order->push_back(index); }
+    void error(std::runtime_error const&) override { }
+    std::vector<int> *order;
+    int index;
+};
+
+// Accumulates everything read from a stream
+class CollectingReadCallback final : public Stream::ReadCallback {
+public:
+    void available(Buffer *buf) override {
+        size_t offset = data.size();
+        data.resize(offset + buf->size());
+        size_t nread = 0;
+        buf->read(&data[offset], buf->size(), &nread);
+    }
+    void eof() override { }
+    void error(std::runtime_error const&) override { }
+    std::string data;
+};
+
+// Collects each delivered frame separately
+class FrameCollector final : public Stream::ReadCallback {
+public:
+    void available(Buffer *buf) override {
+        std::string frame(buf->size(), '\0');
+        size_t nread = 0;
+        buf->read(&frame[0], frame.size(), &nread);
+        frames.push_back(frame);
+    }
+    void eof() override { }
+    void error(std::runtime_error const&) override { errored = true; }
+    std::vector<std::string> frames;
+    bool errored = false;
+};
+
+#if !defined(_WIN32)
+namespace {
+// Connects a nonblocking TCP loopback pair
+void tcpPair(int *client, int *server) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == listener) {
+        throw std::runtime_error("Failed to create socket");
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    *client = -1;
+    *server = -1;
+    if (0 == bind(listener, reinterpret_cast<sockaddr*>(&addr), len) &&
+            0 == listen(listener, 1) &&
+            0 == getsockname(listener, reinterpret_cast<sockaddr*>(&addr),
+                &len)) {
+        *client = socket(AF_INET, SOCK_STREAM, 0);
+        if (*client != -1 && 0 == ::connect(*client,
+                reinterpret_cast<sockaddr*>(&addr), len)) {
+            *server = accept(listener, nullptr, nullptr);
+        }
+    }
+    xclose(listener);
+    if (*server == -1) {
+        if (*client != -1) {
+            xclose(*client);
+        }
+        throw std::runtime_error("Failed to connect loopback pair");
+    }
+    evutil_make_socket_nonblocking(*client);
+    evutil_make_socket_nonblocking(*server);
+}
+
+// Loop until `done` holds, waking periodically so that a stalled stream
+// fails the test instead of hanging it
+template<typename Pred>
+bool loopUntil(EventBase *base, Pred done) {
+    class Wakeup final : public Timeout {
+    public:
+        void expired() NOEXCEPT override { }
+    } wakeup;
+    for (int i = 0; i < 1000 && !done(); ++i) {
+        struct timeval tv { 0, 10000 };
+        base->registerTimeout(&wakeup, &tv);
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    base->unregisterTimeout(&wakeup);
+    return done();
+}
+} // unnamed namespace
+#endif
+
 TEST_F(StreamTest, WritesRaiseCallbackOnCompletion) {
     TestWriteCallback cb1;
     TestWriteCallback cb2;
@@ -212,6 +342,27 @@ TEST_F(StreamTest, WritesRaiseCallbackOnCompletion) {
     ASSERT_EQ(128, nread);
 }
 
+TEST_F(StreamTest, ImmediateWritesCompleteAsConfigured) {
+    TestWriteCallback deferred;
+    TestWriteCallback inlined;
+
+    auto stream = wrapFd(base, fds[0]);
+
+    stream->write("ping", 4, &deferred);
+    ASSERT_FALSE(deferred.completed);
+
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_TRUE(deferred.completed);
+
+    stream->setWriteCompletion(Stream::WriteCompletion::INLINE);
+    stream->write("pong", 4, &inlined);
+    ASSERT_TRUE(inlined.completed);
+
+    // Both went out without waiting for writability
+    char read_buf[8];
+    ASSERT_EQ(8, xread(fds[1], read_buf, sizeof(read_buf)));
+}
+
 TEST_F(StreamTest, LargeWrites) {
     TestWriteCallback wcb;
     TestReadCallback rcb;
@@ -234,6 +385,449 @@ TEST_F(StreamTest, LargeWrites) {
     delete [] wbuf;
 }
 
+#if defined(HAVE_EPOLL)
+TEST_F(EdgeTriggeredStreamTest, WritesBeyondGatherLimitComplete) {
+    int client;
+    int server;
+    tcpPair(&client, &server);
+    // Room for the whole write, so that gathered writes are not cut short
+    // by a full socket buffer
+    int bufsize = 4 * 1024 * 1024;
+    setsockopt(client, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(server, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    auto wstream = wrapFd(base, client);
+    auto rstream = wrapFd(base, server);
+
+    const size_t kSize = 3 * 1024 * 1024;
+    std::string data(kSize, 'w');
+    auto buf = Buffer::create();
+    buf->append(data.data(), data.size());
+    TestWriteCallback wcb;
+    wstream->write(buf.get(), &wcb);
+
+    TestReadCallback rcb;
+    rstream->startRead(&rcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&]() {
+            return wcb.completed && rcb.total_read == kSize;
+        }));
+    wstream->close();
+    rstream->close();
+}
+#endif
+
+TEST_F(StreamTest, PipelinedWritesCompleteInOrder) {
+    auto wstream = wrapFd(base, fds[0]);
+    auto rstream = wrapFd(base, fds[1]);
+
+    // More requests than fit in a single gathered write
+    const int kRequests = 3000;
+    const size_t kSize = 100;
+    std::vector<int> order;
+    std::vector<std::unique_ptr<OrderedWriteCallback>> callbacks;
+    std::string expected;
+    for (int i = 0; i < kRequests; ++i) {
+        callbacks.emplace_back(new OrderedWriteCallback(&order, i));
+        std::string chunk(kSize, static_cast<char>('a' + i % 26));
+        wstream->write(chunk.data(), chunk.size(), callbacks.back().get());
+        expected += chunk;
+    }
+
+    CollectingReadCallback rcb;
+    rstream->startRead(&rcb);
+    while (rcb.data.size() < expected.size()) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    rstream->stopRead();
+
+    ASSERT_EQ(expected, rcb.data);
+    ASSERT_EQ(static_cast<size_t>(kRequests), order.size());
+    for (int i = 0; i < kRequests; ++i) {
+        ASSERT_EQ(i, order[i]);
+    }
+}
+
+TEST_F(StreamTest, SendFileIsOrderedWithWrites) {
+    // Larger than the socket buffer, so that the send is queued
+    std::string contents;
+    for (int i = 0; i < 4 * 1024 * 1024; ++i) {
+        contents.push_back('a' + i % 26);
+    }
+    FILE *file = tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(contents.size(),
+        fwrite(contents.data(), 1, contents.size(), file));
+    fflush(file);
+
+    auto wstream = wrapFd(base, fds[0]);
+    auto rstream = wrapFd(base, fds[1]);
+    std::vector<int> order;
+    OrderedWriteCallback first(&order, 0);
+    OrderedWriteCallback second(&order, 1);
+    OrderedWriteCallback third(&order, 2);
+    OrderedWriteCallback fourth(&order, 3);
+    wstream->write("head", 4, &first);
+    wstream->sendFile(fileno(file), 1, contents.size() - 1, &second);
+    wstream->write("tail", 4, &third);
+    wstream->sendFile(fileno(file), 0, 3, &fourth);
+    std::string expected = "head" + contents.substr(1) + "tail" + "abc";
+
+    CollectingReadCallback rcb;
+    rstream->startRead(&rcb);
+    while (order.size() < 4) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    while (rcb.data.size() < expected.size()) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    rstream->stopRead();
+    fclose(file);
+
+    ASSERT_EQ(expected, rcb.data);
+    ASSERT_EQ(std::vector<int>({ 0, 1, 2, 3 }), order);
+}
+
+#if !defined(_WIN32)
+TEST_F(StreamTest, SendFileRejectsRegionsPastEnd) {
+    FILE *file = tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(10U, fwrite("0123456789", 1, 10, file));
+    fflush(file);
+
+    auto wstream = wrapFd(base, fds[0]);
+    auto rstream = wrapFd(base, fds[1]);
+    TestWriteCallback past;
+    wstream->sendFile(fileno(file), 5, 6, &past);
+    ASSERT_TRUE(past.errored);
+    TestWriteCallback overflow;
+    wstream->sendFile(fileno(file), 1, SIZE_MAX, &overflow);
+    ASSERT_TRUE(overflow.errored);
+    ASSERT_EQ(0U, wstream->pendingWriteBytes());
+
+    // Queue a send behind a write larger than the socket buffer, then
+    // truncate the file before it is sent
+    std::string head(4 * 1024 * 1024, 'h');
+    wstream->write(head.data(), head.size(), nullptr);
+    TestWriteCallback truncated;
+    wstream->sendFile(fileno(file), 0, 10, &truncated);
+    TestWriteCallback tail;
+    wstream->write("tail", 4, &tail);
+    ASSERT_EQ(0, ftruncate(fileno(file), 5));
+
+    // The send fails once, and later writes proceed
+    CollectingReadCallback rcb;
+    rstream->startRead(&rcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&]() {
+            return tail.completed && rcb.data.size() == head.size() + 9;
+        }));
+    rstream->stopRead();
+    fclose(file);
+
+    ASSERT_TRUE(truncated.errored);
+    ASSERT_FALSE(truncated.completed);
+    ASSERT_EQ(head + "01234" + "tail", rcb.data);
+    ASSERT_EQ(0U, wstream->pendingWriteBytes());
+}
+#endif
+
+#if defined(HAVE_MSG_ZEROCOPY)
+
+void StreamTest::expectInputSurvivesPinnedSend() {
+    int client;
+    int server;
+    tcpPair(&client, &server);
+    auto wstream = wrapFd(base, client);
+    auto rstream = wrapFd(base, server);
+    wstream->setZeroCopyThreshold(64 * 1024);
+
+    // Pending at the write-only stream before any send is pinned
+    TestWriteCallback ping;
+    rstream->write("ping", 4, &ping);
+
+    const size_t kSize = 4 * 1024 * 1024;
+    std::string data(kSize, 'z');
+    auto buf = Buffer::create();
+    buf->append(data.data(), data.size());
+    TestWriteCallback wcb;
+    wstream->write(buf.get(), &wcb);
+
+    TestReadCallback rcb;
+    rstream->startRead(&rcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&]() {
+            return wcb.completed && rcb.total_read == kSize;
+        }));
+
+    TestReadCallback wrcb;
+    wstream->startRead(&wrcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&wrcb]() {
+            return wrcb.total_read == 4;
+        }));
+    ASSERT_TRUE(ping.completed);
+    wstream->close();
+    rstream->close();
+}
+
+TEST_F(StreamTest, ZeroCopyWritesReleaseAfterCompletion) {
+    int client;
+    int server;
+    tcpPair(&client, &server);
+    auto wstream = wrapFd(base, client);
+    auto rstream = wrapFd(base, server);
+    wstream->setZeroCopyThreshold(64 * 1024);
+
+    const size_t kSize = 4 * 1024 * 1024;
+    std::unique_ptr<char[]> data(new char[kSize]);
+    memset(data.get(), 'z', kSize);
+    bool released = false;
+    auto buf = Buffer::create();
+    buf->appendExternal(data.get(), kSize, [&released]() { released = true; });
+
+    std::vector<int> order;
+    OrderedWriteCallback first(&order, 0);
+    OrderedWriteCallback second(&order, 1);
+    wstream->write(buf.get(), &first);
+    wstream->write("small", 5, &second);
+
+    TestReadCallback rcb;
+    rstream->startRead(&rcb);
+    while (order.size() < 2 || rcb.total_read < kSize + 5) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    rstream->stopRead();
+
+    // The external memory outlives the send, but not its completion
+    ASSERT_TRUE(released);
+    ASSERT_EQ(std::vector<int>({ 0, 1 }), order);
+    wstream->close();
+    rstream->close();
+}
+
+TEST_F(StreamTest, ZeroCopyWritesCompleteAfterStopRead) {
+    int client;
+    int server;
+    tcpPair(&client, &server);
+    auto wstream = wrapFd(base, client);
+    auto rstream = wrapFd(base, server);
+    wstream->setZeroCopyThreshold(64 * 1024);
+
+    // Stops reading as the last of the write is sent, while it is pinned
+    class StopReading final : public Stream::WatermarkCallback {
+    public:
+        void full(Stream *) override { }
+        void writable(Stream *stream) override {
+            stream->stopRead();
+            stopped = true;
+        }
+        bool stopped = false;
+    } stopReading;
+
+    TestReadCallback wrcb;
+    wstream->startRead(&wrcb);
+
+    const size_t kSize = 4 * 1024 * 1024;
+    wstream->setWriteWatermarks(1, kSize, &stopReading);
+    std::string data(kSize, 'z');
+    auto buf = Buffer::create();
+    buf->append(data.data(), data.size());
+    std::vector<int> order;
+    OrderedWriteCallback first(&order, 0);
+    OrderedWriteCallback second(&order, 1);
+    wstream->write(buf.get(), &first);
+
+    TestReadCallback rcb;
+    rstream->startRead(&rcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&stopReading]() {
+            return stopReading.stopped;
+        }));
+    wstream->write("small", 5, &second);
+
+    ASSERT_TRUE(loopUntil(base.get(), [&]() {
+            return order.size() == 2 && rcb.total_read == kSize + 5;
+        }));
+    ASSERT_EQ(std::vector<int>({ 0, 1 }), order);
+
+    // Once released, writes no longer queue behind pinned sends
+    OrderedWriteCallback third(&order, 2);
+    wstream->write("after", 5, &third);
+    ASSERT_TRUE(loopUntil(base.get(), [&order]() {
+            return order.size() == 3;
+        }));
+    wstream->close();
+    rstream->close();
+}
+
+TEST_F(StreamTest, ZeroCopyUnreadInputDoesNotSpin) {
+    int client;
+    int server;
+    tcpPair(&client, &server);
+    auto wstream = wrapFd(base, client);
+    auto rstream = wrapFd(base, server);
+    wstream->setZeroCopyThreshold(64 * 1024);
+
+    // Input for the write-only stream, which it leaves unread
+    TestWriteCallback ping;
+    rstream->write("ping", 4, &ping);
+
+    // More than the socket buffers hold; the peer is not yet reading, so
+    // sends stay pinned
+    const size_t kSize = 32 * 1024 * 1024;
+    std::string data(kSize, 'z');
+    auto buf = Buffer::create();
+    buf->append(data.data(), data.size());
+    TestWriteCallback wcb;
+    wstream->write(buf.get(), &wcb);
+
+    // Each iteration waits for a timeout, rather than returning at once
+    // to report the unread input
+    class Wakeup final : public Timeout {
+    public:
+        void expired() NOEXCEPT override { }
+    } wakeup;
+    int iterations = 0;
+    auto deadline = std::chrono::steady_clock::now()
+        + std::chrono::milliseconds(50);
+    while (std::chrono::steady_clock::now() < deadline) {
+        struct timeval tv { 0, 1000 };
+        base->registerTimeout(&wakeup, &tv);
+        base->loop(EventBase::LoopMode::ONCE);
+        ++iterations;
+    }
+    base->unregisterTimeout(&wakeup);
+    ASSERT_FALSE(wcb.completed);
+    ASSERT_LT(iterations, 500);
+
+    TestReadCallback rcb;
+    rstream->startRead(&rcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&]() {
+            return wcb.completed && rcb.total_read == kSize;
+        }));
+    TestReadCallback wrcb;
+    wstream->startRead(&wrcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&wrcb]() {
+            return wrcb.total_read == 4;
+        }));
+    wstream->close();
+    rstream->close();
+}
+
+TEST_F(StreamTest, ZeroCopyWriteOnlyStreamKeepsInput) {
+    expectInputSurvivesPinnedSend();
+}
+
+#if defined(HAVE_EPOLL)
+TEST_F(EdgeTriggeredStreamTest, ZeroCopyWriteOnlyStreamKeepsInput) {
+    expectInputSurvivesPinnedSend();
+}
+#endif
+#endif
+
+TEST_F(StreamTest, QueuedWriteRequestsAreRecycled) {
+    auto *pool = dynamic_cast<NotifyingEventBase*>(base.get())
+        ->writeRequestPool();
+
+    auto wstream = wrapFd(base, fds[0]);
+    auto rstream = wrapFd(base, fds[1]);
+    TestReadCallback rcb;
+    rstream->startRead(&rcb);
+
+    // More than the socket buffer holds, so that the small writes queue
+    const size_t kLarge = 1 << 20;
+    const int kSmall = 10;
+    std::unique_ptr<char[]> data(new char[kLarge]);
+    memset(data.get(), 'A', kLarge);
+
+    auto writeAll = [&]() -> void {
+        TestWriteCallback wcb;
+        wstream->write(data.get(), kLarge, nullptr);
+        for (int i = 0; i < kSmall; ++i) {
+            wstream->write(data.get(), 64, &wcb);
+        }
+        while (!wcb.completed) {
+            base->loop(EventBase::LoopMode::ONCE);
+        }
+    };
+
+    writeAll();
+    auto first = pool->stats();
+    ASSERT_EQ(static_cast<size_t>(kSmall + 1), first.hits + first.misses);
+
+    writeAll();
+    auto second = pool->stats();
+    ASSERT_EQ(first.misses, second.misses);
+    ASSERT_EQ(first.hits + kSmall + 1, second.hits);
+
+    rstream->stopRead();
+}
+
+TEST_F(StreamTest, WatermarksTrackQueuedWrites) {
+    class Watermarks final : public Stream::WatermarkCallback {
+    public:
+        void full(Stream *) override { ++fullCount; }
+        void writable(Stream *) override { ++writableCount; }
+        int fullCount = 0;
+        int writableCount = 0;
+    };
+
+    auto wstream = wrapFd(base, fds[0]);
+    auto rstream = wrapFd(base, fds[1]);
+
+    Watermarks watermarks;
+    wstream->setWriteWatermarks(1024, 64 * 1024, &watermarks);
+
+    // More than the socket buffer holds
+    const size_t kLarge = 2 << 20;
+    std::unique_ptr<char[]> data(new char[kLarge]);
+    memset(data.get(), 'A', kLarge);
+    TestWriteCallback large;
+    wstream->write(data.get(), kLarge, &large);
+    size_t pending = wstream->pendingWriteBytes();
+    ASSERT_GE(pending, 64u * 1024);
+    ASSERT_EQ(1, watermarks.fullCount);
+
+    // Writes beyond the limit fail without queueing
+    wstream->setMaxPendingWriteBytes(pending + 100);
+    TestWriteCallback rejected;
+    wstream->write(data.get(), 200, &rejected);
+    ASSERT_TRUE(rejected.errored);
+    ASSERT_EQ(pending, wstream->pendingWriteBytes());
+
+    TestWriteCallback accepted;
+    wstream->write(data.get(), 100, &accepted);
+    ASSERT_FALSE(accepted.errored);
+    ASSERT_EQ(pending + 100, wstream->pendingWriteBytes());
+
+    TestReadCallback rcb;
+    rstream->startRead(&rcb);
+    while (!accepted.completed) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    rstream->stopRead();
+
+    ASSERT_TRUE(large.completed);
+    ASSERT_EQ(0u, wstream->pendingWriteBytes());
+    ASSERT_EQ(1, watermarks.fullCount);
+    ASSERT_EQ(1, watermarks.writableCount);
+
+    // The limit applies to the whole write, even with nothing queued
+    TestWriteCallback oversized;
+    wstream->write(data.get(), pending + 101, &oversized);
+    ASSERT_TRUE(oversized.errored);
+    ASSERT_EQ(0u, wstream->pendingWriteBytes());
+
+    // A low watermark of 0 fires once the queue drains
+    wstream->setMaxPendingWriteBytes(0);
+    wstream->setWriteWatermarks(0, 64 * 1024, &watermarks);
+    TestWriteCallback refill;
+    wstream->write(data.get(), kLarge, &refill);
+    ASSERT_EQ(2, watermarks.fullCount);
+    rstream->startRead(&rcb);
+    while (!refill.completed) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
+    rstream->stopRead();
+    ASSERT_EQ(0u, wstream->pendingWriteBytes());
+    ASSERT_EQ(2, watermarks.writableCount);
+}
+
 TEST_F(StreamTest, WriteErrorsRaiseCallback) {
     // TODO: this appears to be racy on Windows, insofar as the write
     // may not detect an error on the closed connection. I'm not sure
@@ -266,14 +860,73 @@ TEST_F(StreamTest, ReadableDataRaisesCallback) {
     wstream->write("ping", 4, &wcb);
     rstream->startRead(&rcb);
 
-    base->loop(EventBase::LoopMode::ONCE);
-    base->loop(EventBase::LoopMode::ONCE);
+    // The write may complete without waiting for writability
+    while (rcb.total_read < 4) {
+        base->loop(EventBase::LoopMode::ONCE);
+    }
 
     ASSERT_TRUE(wcb.completed);
     ASSERT_FALSE(rcb.errored);
     ASSERT_EQ(4, rcb.total_read);
 }
 
+TEST_F(StreamTest, DelimitedFramesSpanReads) {
+    auto rstream = wrapFd(base, fds[1]);
+    ReadFraming framing;
+    framing.mode = ReadFraming::Mode::DELIMITED;
+    framing.size = 16;
+    rstream->setReadFraming(framing);
+
+    FrameCollector rcb;
+    rstream->startRead(&rcb);
+
+    ASSERT_EQ(6, xwrite(fds[0], "one\ntw", 6));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(1u, rcb.frames.size());
+
+    ASSERT_EQ(8, xwrite(fds[0], "o\nthree\n", 8));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ((std::vector<std::string> { "one\n", "two\n", "three\n" }),
+        rcb.frames);
+
+    // No delimiter within the limit
+    ASSERT_EQ(17, xwrite(fds[0], "aaaaaaaaaaaaaaaaa", 17));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_TRUE(rcb.errored);
+}
+
+TEST_F(StreamTest, LengthPrefixedAndFixedFrames) {
+    auto rstream = wrapFd(base, fds[1]);
+    ReadFraming framing;
+    framing.mode = ReadFraming::Mode::LENGTH_PREFIXED;
+    framing.prefixWidth = 2;
+    framing.endian = ReadFraming::Endian::LITTLE;
+    rstream->setReadFraming(framing);
+
+    FrameCollector rcb;
+    rstream->startRead(&rcb);
+
+    // Pipelined frames, the last one partial
+    ASSERT_EQ(12, xwrite(fds[0], "\x03\0abc\0\0\x05\0xyz", 12));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ((std::vector<std::string> { "abc", "" }), rcb.frames);
+
+    ASSERT_EQ(2, xwrite(fds[0], "zy", 2));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(3u, rcb.frames.size());
+    ASSERT_EQ("xyzzy", rcb.frames[2]);
+
+    framing.mode = ReadFraming::Mode::FIXED;
+    framing.size = 3;
+    rstream->setReadFraming(framing);
+    ASSERT_EQ(7, xwrite(fds[0], "abcdefg", 7));
+    base->loop(EventBase::LoopMode::ONCE);
+    ASSERT_EQ(5u, rcb.frames.size());
+    ASSERT_EQ("def", rcb.frames[4]);
+
+    rstream->stopRead();
+}
+
 TEST_F(StreamTest, CloseRaisesEofCallback) {
     TestReadCallback rcb;
     auto rstream = wrapFd(base, fds[1]);
@@ -285,6 +938,20 @@ TEST_F(StreamTest, CloseRaisesEofCallback) {
     fds[1] = -1;
 }
 
+#if defined(HAVE_EPOLL)
+TEST_F(EdgeTriggeredStreamTest, EofAfterDataRaisesCallback) {
+    // The data and the shutdown are reported by a single edge
+    ASSERT_EQ(4, xwrite(fds[0], "ping", 4));
+    ASSERT_EQ(0, shutdown(fds[0], SHUT_WR));
+
+    TestReadCallback rcb;
+    auto rstream = wrapFd(base, fds[1]);
+    rstream->startRead(&rcb);
+    ASSERT_TRUE(loopUntil(base.get(), [&rcb]() { return rcb.hit_eof; }));
+    ASSERT_EQ(4U, rcb.total_read);
+}
+#endif
+
 TEST_F(StreamTest, TestConnect) {
     EchoServer echo(base);
 
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+#include <thread>
+
+#include "wte/event_base.h"
+#include "wte/task.h"
+
+namespace wte {
+
+namespace {
+// A move-only callable, which std::function cannot hold
+struct Increment {
+    explicit Increment(int *target) : target(target), amount(new int(1)) { }
+    void operator()() { *target += *amount; }
+    int *target;
+    std::unique_ptr<int> amount;
+};
+} // unnamed namespace
+
+TEST(TaskTest, Basic) {
+    Task empty;
+    ASSERT_FALSE(empty);
+    ASSERT_THROW(empty(), std::bad_function_call);
+
+    int value = 0;
+    Task task([&value]() { ++value; });
+    ASSERT_TRUE(task);
+    task();
+    ASSERT_EQ(1, value);
+
+    // Moving transfers the target
+    Task moved(std::move(task));
+    ASSERT_FALSE(task);
+    moved();
+    ASSERT_EQ(2, value);
+}
+
+TEST(TaskTest, MoveOnlyAndLargeTargets) {
+    std::shared_ptr<int> count = std::make_shared<int>(0);
+    {
+        std::array<char, 2 * Task::kInlineSize> large{};
+        Task small(Increment(count.get()));
+        Task big([count, large]() { *count += large.size(); });
+
+        Task other;
+        other = std::move(big);
+        small();
+        other();
+        ASSERT_EQ(static_cast<int>(1 + large.size()), *count);
+    }
+    // Both targets were destroyed
+    ASSERT_EQ(1, count.use_count());
+}
+
+TEST(TaskTest, RunOnEventLoopAcceptsMoveOnlyClosures) {
+    auto base = mkEventBase();
+    std::thread loop([&base]() { base->loop(EventBase::LoopMode::FOREVER); });
+
+    int value = 0;
+    ASSERT_TRUE(base->runOnEventLoopAndWait(Increment(&value),
+        /*defer=*/ true));
+    ASSERT_EQ(1, value);
+
+    base->stop();
+    loop.join();
+}
+
+} // wte namespace
@@ -21,7 +21,9 @@
  */
 
 #include <chrono>
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include "event_base_test.h"
 #include "wte/porting.h"
@@ -61,4 +63,86 @@ TEST_F(TimeoutTest, UnregisteredTimeoutsDoNotFire) {
     ASSERT_EQ(0, timeout.count);
 }
 
+TEST_F(TimeoutTest, RearmingDefersExpiry) {
+    struct timeval shortly { 0, 1000 };
+    struct timeval later { 0, 20000 };
+    TestTimeout timeout;
+    base->registerTimeout(&timeout, &shortly);
+    base->registerTimeout(&timeout, &later);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    base->unregisterTimeout(&timeout);
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_EQ(0, timeout.count);
+}
+
+TEST_F(TimeoutTest, DestroyedTimeoutsAreDisarmed) {
+    struct timeval tv { 0, 1000 };
+    std::unique_ptr<TestTimeout> timeout(new TestTimeout());
+    base->registerTimeout(timeout.get(), &tv);
+    timeout.reset();
+    // Returns immediately, since nothing remains registered
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+}
+
+class TimerWheelTest : public EventBaseTest {
+public:
+    TimerWheelTest() : EventBaseTest(tickOptions()) { }
+
+    static EventBaseOptions tickOptions() {
+        EventBaseOptions options;
+        options.timerTickMillis = 2;
+        return options;
+    }
+
+    class OrderedTimeout final : public Timeout {
+    public:
+        OrderedTimeout(EventBase *base, std::vector<int> *order, int id)
+            : base_(base), order_(order), id_(id) { }
+        void expired() NOEXCEPT {
+            order_->push_back(id_);
+            if (cancel) {
+                base_->unregisterTimeout(cancel);
+            }
+        }
+        Timeout *cancel = nullptr;
+    private:
+        EventBase *base_;
+        std::vector<int> *order_;
+        int id_;
+    };
+};
+
+TEST_F(TimerWheelTest, FiresInDeadlineOrderAcrossLevels) {
+    std::vector<int> order;
+    // 600ms is beyond the first level of 256 2ms ticks
+    struct timeval durations[] = { { 0, 600000 }, { 0, 1000 }, { 0, 30000 } };
+    OrderedTimeout t0(base.get(), &order, 0);
+    OrderedTimeout t1(base.get(), &order, 1);
+    OrderedTimeout t2(base.get(), &order, 2);
+    base->registerTimeout(&t0, &durations[0]);
+    base->registerTimeout(&t1, &durations[1]);
+    base->registerTimeout(&t2, &durations[2]);
+
+    auto start = std::chrono::steady_clock::now();
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    ASSERT_EQ((std::vector<int>{ 1, 2, 0 }), order);
+    ASSERT_GE(elapsed, std::chrono::milliseconds(600));
+}
+
+TEST_F(TimerWheelTest, CallbacksMayCancelPendingTimeouts) {
+    std::vector<int> order;
+    struct timeval tv { 0, 1000 };
+    OrderedTimeout t0(base.get(), &order, 0);
+    OrderedTimeout t1(base.get(), &order, 1);
+    // Both land in the same tick; whichever fires first cancels the other
+    t0.cancel = &t1;
+    t1.cancel = &t0;
+    base->registerTimeout(&t0, &tv);
+    base->registerTimeout(&t1, &tv);
+    base->loop(EventBase::LoopMode::UNTIL_EMPTY);
+    ASSERT_EQ(1u, order.size());
+}
+
 } // wte namespace